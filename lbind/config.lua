@@ -1,11 +1,62 @@
 local M = {}
 local indent = 4
+local lua_version = 503
+local checked = true
 
 function M.indent()
     return indent
 end
 
+-- target Lua version, as LUA_VERSION_NUM (501 for LuaJIT)
+function M.lua_version()
+    return lua_version
+end
+
+-- checked builds add range checks to narrowing conversions
+function M.checked()
+    return checked
+end
+
+-- a template can be a table of templates keyed by target Lua version,
+-- with an optional "checked" entry: pick the "checked" one in checked
+-- builds, else the one of the highest version not above target.
+function M.template(tpl)
+    if type(tpl) ~= 'table' then return tpl end
+    if checked and tpl.checked then return tpl.checked end
+    local best, bestver = nil, 0
+    for ver, v in pairs(tpl) do
+        if type(ver) == 'number' and ver <= lua_version and ver > bestver then
+            best, bestver = v, ver
+        end
+    end
+    return best
+end
+
+local function parse_version(v)
+    if type(v) == 'number' then
+        return v < 100 and math.floor(v*10 + 0.5)%10 + 500 or v
+    end
+    if v == "luajit" or v == "jit" then
+        return 501
+    end
+    local major, minor = tostring(v):match "(%d+)%.(%d+)"
+    assert(major, "invalid Lua version: "..tostring(v))
+    return major*100 + minor
+end
+
 function M.parse_config(config)
+    indent = config.indent or indent
+    if config.lua_version then
+        lua_version = parse_version(config.lua_version)
+    end
+    if config.checked ~= nil then
+        checked = config.checked
+    end
+    return M
 end
 
-return M
+return setmetatable(M, {
+    __call = function(self, config)
+        return self.parse_config(config)
+    end
+})
@@ -0,0 +1,232 @@
+-- LuaJIT FFI backend.
+-- generate a pure Lua binding module from the same AST as the C
+-- backend: the C API is declared with ffi.cdef and objects are cdata
+-- with a ffi.metatype method table, so calls can be compiled by the
+-- JIT instead of aborting the trace.
+--
+-- only C APIs can be bound this way, methods with C code (body, call,
+-- prev or post) have no FFI form and are left out with a note.
+local utils = require 'lbind.utils'
+local types = require 'lbind.types'
+local M = {}
+
+local T = types.basetypes()
+
+local function ctype_of(t, self)
+    if type(t) == 'string' then
+        if not T[t] then return t end
+        t = T[t]
+    end
+    if t.tag == 'var' then
+        local s = ctype_of(t.type, self)
+        if t.is_const then s = "const "..s end
+        if t.is_ptr or t.is_ref then s = s.." *" end
+        return s
+    end
+    local name = t.name
+    if name == "<self>" then return self end
+    if t.type_c then return t.type_c end
+    local base = name:match "^(.-)_[pr]$"
+    if base then return ctype_of(base, self).." *" end
+    base = name:match "^const_(.*)$"
+    if base then return "const "..ctype_of(base, self) end
+    base = name:match "^volatile_(.*)$"
+    if base then return "volatile "..ctype_of(base, self) end
+    return name
+end
+
+local function is_selfptr(t)
+    if type(t) ~= 'table' then return false end
+    if t.tag == 'var' then
+        return (t.is_ptr or false) and t.type.name == "<self>"
+    end
+    return t.name == "<self>_p"
+end
+
+local function is_string(ctype)
+    return ctype:match "^[%w%s]*char%s*%*$" ~= nil
+end
+
+local function has_code(entry)
+    return entry.body or entry.call or entry.prev or entry.post
+end
+
+local function collect(module)
+    local objects, funcs, luacode = {}, {}, {}
+    local function walk(node, object)
+        for i, v in ipairs(node) do
+            if v.tag == 'object' then
+                objects[#objects+1] = v
+                walk(v, v)
+            elseif v.tag == 'func' or v.tag == 'method' then
+                if not object then funcs[#funcs+1] = v end
+            elseif v.tag == 'lua' then
+                luacode[#luacode+1] = v
+            end
+        end
+    end
+    walk(module)
+    return objects, funcs, luacode
+end
+
+-- returns the declaration and the Lua parameter list of a function
+-- entry, or nil if it can't be bound by FFI.
+local function signature(fn, entry, self, hasself)
+    if has_code(entry) then return end
+    local rets = entry.rets or {}
+    if #rets > 1 then return end
+    local rtype = rets[1] and ctype_of(rets[1], self) or "void"
+    local params, names = {}, {}
+    if hasself then
+        params[1] = self.." *self"
+        names[1] = "self"
+    end
+    for i, v in ipairs(entry.args or {}) do
+        local name = v.name or "a"..i
+        params[#params+1] = ctype_of(v, self).." "..name
+        names[#names+1] = name
+    end
+    local cname = fn.cname or fn.name
+    local decl = ("%s %s(%s);"):format(rtype, cname,
+        #params == 0 and "void" or table.concat(params, ", "))
+    return decl, names, rtype
+end
+
+local function gen_defaults(_, entry)
+    for i, v in ipairs(entry.args or {}) do
+        if v.opt_tpl and tonumber(v.opt_tpl) then
+            local name = v.name or "a"..i
+            _("if "..name.." == nil then "..name.." = "..v.opt_tpl.." end")
+        end
+    end
+end
+
+local function gen_return(_, call, rtype)
+    if rtype == "void" then
+        _(call)
+    elseif is_string(rtype) then
+        _("local r = "..call)
+        _"if r == nil then return nil end"
+        _"return ffi.string(r)"
+    else
+        _("return "..call)
+    end
+end
+
+local function gen_function(_, owner, fn, self, dtor)
+    local entry = fn[1] or {}
+    local ctor = entry.rets and is_selfptr(entry.rets[1])
+    local hasself = self and fn.tag == 'method' and not ctor
+    local decl, names, rtype = signature(fn, entry, self, hasself)
+    if not decl then
+        _("-- "..owner.."."..fn.name..": has no FFI form, skipped")
+        return
+    end
+    if #fn > 1 then
+        _("-- "..owner.."."..fn.name..": overloads are not supported,"..
+          " only the first one is bound")
+    end
+    local cname = "C."..(fn.cname or fn.name)
+    local call = cname.."("..table.concat(names, ", ")..")"
+    local params = table.concat(names, ", ", hasself and 2 or 1)
+    if hasself then
+        _("function "..owner..":"..fn.name.."("..params..")")
+    else
+        _("function "..owner.."."..fn.name.."("..params..")")
+    end
+    _(4)
+    gen_defaults(_, entry)
+    if ctor and dtor then
+        -- objects made by Lua are deleted on collection, as lbind does
+        _("local self = "..call)
+        _"if self == nil then return nil end"
+        _("return ffi.gc(self, C."..(dtor.cname or dtor.name)..")")
+    elseif fn == dtor then
+        _"ffi.gc(self, nil)"
+        gen_return(_, call, rtype)
+    else
+        gen_return(_, call, rtype)
+    end
+    _(-4)"end"
+    for i, alias in ipairs(fn.names or {}) do
+        _(owner.."."..alias.." = "..owner.."."..fn.name)
+    end
+end
+
+local function find_dtor(object)
+    for i, v in ipairs(object) do
+        if v.tag == 'method' and (v.name == "delete" or v.name == "__gc") then
+            return v
+        end
+    end
+end
+
+function M.generate(module)
+    local objects, funcs, luacode = collect(module)
+    local t = {}
+    local _ = utils.builder(t)
+
+    _"-- generated by lbind, do not edit."
+    _"local ffi = require 'ffi'"
+    _""
+    _"ffi.cdef [["
+    for i, object in ipairs(objects) do
+        _(("typedef struct %s %s;"):format(object.name, object.name))
+    end
+    for i, object in ipairs(objects) do
+        for j, fn in ipairs(object) do
+            if fn.tag == 'method' or fn.tag == 'func' then
+                local entry = fn[1] or {}
+                local ctor = entry.rets and is_selfptr(entry.rets[1])
+                local decl = signature(fn, entry, object.name,
+                    fn.tag == 'method' and not ctor)
+                if decl then _(decl) end
+            end
+        end
+    end
+    for i, fn in ipairs(funcs) do
+        local decl = signature(fn, fn[1] or {})
+        if decl then _(decl) end
+    end
+    _"]]"
+    _""
+    if module.lib then
+        _(("local C = ffi.load %q"):format(module.lib))
+    else
+        _"local C = ffi.C"
+    end
+    _"local M = {}"
+
+    for i, object in ipairs(objects) do
+        local name, dtor = object.name, find_dtor(object)
+        _""
+        _("local "..name.." = {}")
+        _(name..".__index = "..name)
+        _("M."..name.." = "..name)
+        for j, fn in ipairs(object) do
+            if fn.tag == 'method' or fn.tag == 'func' then
+                gen_function(_, name, fn, name, dtor)
+            end
+        end
+        _(("ffi.metatype(%q, %s)"):format(name, name))
+    end
+    if #funcs ~= 0 then _"" end
+    for i, fn in ipairs(funcs) do
+        gen_function(_, "M", fn)
+    end
+    for i, code in ipairs(luacode) do
+        _""
+        _(code)
+    end
+    _""
+    _"return M"
+    return table.concat(t, "\n").."\n"
+end
+
+function M.write(module, filename)
+    local fh = assert(io.open(filename, "w"))
+    fh:write(M.generate(module))
+    fh:close()
+end
+
+return M
@@ -34,6 +34,13 @@ local function stringmethod(name)
     end
 end
 
+local function flagmethod(name)
+    return function(self, value)
+        self[name] = value ~= false
+        return self
+    end
+end
+
 local function vamethod(name, new)
     return function(self, ...)
         local t = {...}
@@ -72,6 +79,19 @@ local funcMT = {
     prev = codemethod 'prev',
     cname = stringmethod 'cname',
     lname = stringmethod 'lname',
+    -- arguments are not checked in release builds, see lbind_trusted()
+    trusted = flagmethod 'trusted',
+    -- call runs in executor of lbind, and yields, see lbind_await()
+    async = flagmethod 'async',
+    -- declared types are the exact C prototype, so the binding can be
+    -- shared with others of the same prototype, see gen_thunks()
+    exact = flagmethod 'exact',
+    -- results go into a optional trailing table, by position, or by
+    -- name with :resulttable "named", see lbind_resulttable()
+    resulttable = function(self, kind)
+        self.resulttable = kind or "array"
+        return self
+    end,
 }
 funcMT.__index = funcMT
 funcMT.__call = funcMT.args
@@ -136,4 +156,8 @@ function M.func(name)
     return func(name)
 end
 
+function M.virtual(name)
+    return func(name, "virtual")
+end
+
 return M
@@ -1,6 +1,7 @@
 local M = {}
 local types = {}
 local utils = require 'lbind.utils'
+local config = require 'lbind.config'
 
 local function typeref(t)
     local refinfo = {}
@@ -13,6 +14,8 @@ local function typeref(t)
             return self.ctype or self.typename
         elseif k == 'ltype' then
             return self.ltype or self.typename
+        elseif k == 'defaultvalue' then
+            return refinfo.default or self.initvalue
         end
         return self[k]
     end
@@ -33,7 +36,13 @@ local function typeref(t)
         return self
     end
 
+    function ref:readonly()
+        refinfo.readonly = true
+        return self
+    end
+
     function ref:isopt() return refinfo.opt end
+    function ref:isreadonly() return refinfo.readonly end
     function ref:optvalue() return refinfo.default or refinfo.initvalue end
     function ref:opt_check() return refinfo.opt_check_tpl end
     function ref:name() return refinfo.name end
@@ -62,7 +71,8 @@ local function typeref(t)
     local function gen_template(name)
         ref['gen_'..name] = function(self, narg)
             refinfo.narg = narg
-            local ret = utils.template(refinfo[name.."_tpl"], refinfo)
+            local ret = utils.template(
+                config.template(refinfo[name.."_tpl"]), refinfo)
             refinfo.narg = nil
             return ret, refinfo[name.."_nstack"]
         end
@@ -73,7 +83,17 @@ local function typeref(t)
     gen_template "opt_check"
 
     function ref:gen_push()
-        return utils.template(refinfo.push_tpl, refinfo), refinfo.push_nstack
+        return utils.template(config.template(refinfo.push_tpl), refinfo),
+            refinfo.push_nstack
+    end
+    -- code run after the call, e.g. releasing what the argument holds,
+    -- or the `kept` code if the argument is kept. nil if there is none.
+    function ref:gen_post()
+        local tpl = refinfo.keep and refinfo.kept_tpl
+                 or not refinfo.keep and refinfo.post_tpl
+        if tpl then
+            return utils.template(config.template(tpl), refinfo)
+        end
     end
 
     return ref
@@ -115,6 +135,14 @@ function M.type(name)
         info.assign_tpl = utils.trim(s)
         return self
     end
+    function t:stack(n)
+        info.stack = n
+        return self
+    end
+    function t:field(kind)
+        info.field = kind
+        return self
+    end
     function t:decl(decl, arg)
         if decl then info.decl_tpl = utils.trim(decl) end
         if arg then info.decl_arg = utils.trim(arg) end
@@ -123,13 +151,13 @@ function M.type(name)
 
     local function collect_template(name)
         t[name] = function(self, nstack)
-            if type(nstack) == 'string' then
-                info[name.."_tpl"] = utils.trim(nstack)
+            if type(nstack) ~= 'number' then
+                info[name.."_tpl"] = utils.trimtemplate(nstack)
                 info[name.."_nstack"] = 1
                 return self
             end
             return function(s)
-                info[name.."_tpl"] = utils.trim(s)
+                info[name.."_tpl"] = utils.trimtemplate(s)
                 info[name.."_nstack"] = nstack
                 return self
             end
@@ -140,6 +168,8 @@ function M.type(name)
     collect_template 'check'
     collect_template 'opt_check'
     collect_template 'push'
+    collect_template 'post'
+    collect_template 'kept'
 
     function t:info()
         return info
@@ -161,33 +191,213 @@ function M.type(name)
     return t
 end
 
+-- callback "f"(int, int):rets(int)
+-- declare a argument of C function pointer type. the pointer comes
+-- from a pool of generated thunks, see gen_callback(). the thunk is
+-- released after the call, mark callbacks the C side stores with
+-- `:keep()`, these are released by lbind_releasecallback(). callbacks
+-- are bound after the other arguments are checked, and a guard left on
+-- stack releases them if the call fails before its post code.
 function M.callback(name)
+    return function(...)
+        local t = M.type("callback_"..name) :ctype("lbC_"..name.."_t")
+            :check "($type)lbind_checkcallback(L, $narg, &lbC_${cbname}_pool)"
+            :to "($type)lbind_bindcallback(L, $narg, &lbC_${cbname}_pool)"
+            :post "lbind_releasecallback(&lbC_${cbname}_pool, (lbind_Thunk)$name)"
+            :kept "lbind_keepcallback(&lbC_${cbname}_pool, (lbind_Thunk)$name)"
+        local info = t:info()
+        info.late = true
+        info.cbname = name
+        info.cbargs = {...}
+        info.cbpool = 16
+        local ref = t(name)
+        function ref:rets(...)
+            info.cbrets = {...}
+            return self
+        end
+        function ref:pool(n)
+            info.cbpool = n
+            return self
+        end
+        function ref:keep()
+            self:info().keep = true
+            return self
+        end
+        return ref
+    end
 end
 
-function M.classtype(name)
-    local t = M.type(name)
+-- generate the thunk pool of a callback argument.
+function M.gen_callback(_, cb)
+    local info = cb:info()
+    local prefix, ctype = "lbC_"..info.cbname, info.ctype
+    local args, rets = info.cbargs, info.cbrets or {}
+    assert(#rets <= 1, "callback can only return one value")
+
+    local params, names = {}, {}
+    for i, v in ipairs(args) do
+        local r = v:ref("a", i)
+        params[i] = r:ctype().." "..r:name()
+        names[i] = ", "..r:name()
+    end
+    local ret = rets[1] and rets[1]:ref "r"
+    local rtype = ret and ret:ctype() or "void"
+    local plist = #params == 0 and "void" or table.concat(params, ", ")
+    local body = ("static %s %s_thunk(int i%s)")
+        :format(rtype, prefix, #params == 0 and "" or ", "..plist)
+
+    _("typedef "..rtype.." (*"..ctype..")("..plist..");")
+    _("static lbind_Callback "..prefix.."_slots["..info.cbpool.."];")
+    _(body..";")
+    _""
+    for i = 0, info.cbpool-1 do
+        _(("static %s %s_%d(%s) { %s%s_thunk(%d%s); }")
+            :format(rtype, prefix, i, plist, ret and "return " or "",
+                    prefix, i, table.concat(names)))
+    end
+    _""
+    _("static const lbind_Thunk "..prefix.."_thunks[] = {")
+    _(4)
+    for i = 0, info.cbpool-1 do
+        _("(lbind_Thunk)"..prefix.."_"..i..",")
+    end
+    _(-4)"};"
+    _(("static lbind_CallbackPool %s_pool = LBIND_CALLBACKPOOL(%q, %s_slots, %s_thunks);")
+        :format(prefix, info.cbname, prefix, prefix))
+    _""
+    -- the main thread may be in any state here, it's not a fresh C call:
+    -- reserve its stack before pushing, and errors are only reported,
+    -- the thunk returns the initial value of result then.
+    _(body.." {")
+    _(4)
+    if ret then _((ret:gen_decl()))";" end
+    local nstack = 0
+    for i, v in ipairs(args) do
+        nstack = nstack + (v:info().push_nstack or 1)
+    end
+    _(("lua_State *L = lbind_pushcallback(&%s_pool, i, %d);")
+        :format(prefix, math.max(nstack, #rets) + M.stack_budget(args)))
+    _(ret and "if (L == NULL) return r;" or "if (L == NULL) return;")
+    for i, v in ipairs(args) do
+        _((v:ref("a", i):gen_push()))";"
+    end
+    local call = ("lbind_callcallback(L, &%s_pool, %d, %d)")
+        :format(prefix, nstack, #rets)
+    if ret then
+        _("if ("..call..") {")
+        _(4)
+        _((ret:gen_assign((ret:gen_to(-1)))))";"
+        _"lua_pop(L, 1);"
+        _(-4)"}"
+        _"return r;"
+    else
+        _(call..";")
+    end
+    _(-4)"}"
+end
+
+-- struct "Point" { double "x", double "y" }
+-- declare a C struct with field members, which can be converted between
+-- C arrays and Lua tables in bulk, see gen_struct(). fields can also be
+-- served as object accessors by gen_setfields(), mark the ones can't be
+-- written by `double "x" :readonly()`.
+function M.struct(name)
+    return function(fields)
+        local t = M.type("struct_"..name) :ctype(name)
+        local info = t:info()
+        info.stname = name
+        info.stfields = fields
+        return t
+    end
+end
 
+-- generate the field list and array converters of a struct.
+function M.gen_struct(_, st)
+    local info = st:info()
+    local prefix, ctype = "lbS_"..info.stname, info.ctype
+
+    _("static const lbind_Field "..prefix.."_fields[] = {")
+    _(4)
+    for i, v in ipairs(info.stfields) do
+        local kind = v:info().field
+        assert(kind, "type '"..v:info().typename.."' can not be a field")
+        _(("%s(%s, %s, %s),"):format(
+            v:isreadonly() and "LBIND_RFIELD" or "LBIND_FIELD",
+            ctype, v:name(), kind))
+    end
+    _"{ NULL }"
+    _(-4)"};"
+    _""
+    for i, dir in ipairs { "structs", "columns" } do
+        _(("static void %s_push%s(lua_State *L, const %s *a, size_t n) {")
+            :format(prefix, dir, ctype))
+        _(4)
+        _(("lbind_push%s(L, a, n, sizeof(%s), %s_fields);")
+            :format(dir, ctype, prefix))
+        _(-4)"}"
+        _""
+        _(("static size_t %s_to%s(lua_State *L, int idx, %s *a, size_t n) {")
+            :format(prefix, dir, ctype))
+        _(4)
+        _(("return lbind_to%s(L, idx, a, n, sizeof(%s), %s_fields);")
+            :format(dir, ctype, prefix))
+        _(-4)"}"
+        _""
+    end
+end
+
+-- a declared struct is plain data: make the lbind_Type lbT_<name> of it
+-- a value type flagged LBIND_POD, so its objects are packed as bytes.
+function M.gen_podtype(_, st)
+    local info = st:info()
+    _(("lbind_setvalue(&lbT_%s, sizeof(%s), NULL, NULL, NULL);")
+        :format(info.stname, info.ctype))
+    _(("lbind_setpod(&lbT_%s, 1);"):format(info.stname))
+end
+
+-- install the fields of a struct as accessors of the metatable on top
+-- of stack, all fields share one accessor in runtime, instead of a
+-- getter and setter function for each.
+function M.gen_setfields(_, st)
+    _(("lbind_setfields(L, lbS_%s_fields, LBIND_INDEX|LBIND_NEWINDEX);")
+        :format(st:info().stname))
+end
+
+function M.classtype(name)
+    local t = M.type(name) :ltype(name) :ctype(name.." *")
+        :decl [[ $type$name ]]
+        :initvalue "NULL"
+        :is [[ lbind_test(L, $narg, &lbT_$typename) != NULL ]]
+        :check [[ ($type)lbind_check(L, $narg, &lbT_$typename) ]]
+        :to [[ ($type)lbind_object(L, $narg) ]]
 
     return t
 end
 
 function M.basetypes(t)
-    t.int = M.type "int" :ltype "integer"
-        :is [[ lua_isnumber(L, $narg) ]]
+    -- templates keyed by target version, see config.template()
+    t.int = M.type "int" :ltype "integer" :field "LBIND_FINT"
+        :is { [501] = "lua_isnumber(L, $narg)",
+              [503] = "lbind_isinteger(L, $narg)" }
         :push [[ lua_pushinteger(L, $name) ]]
-        :opt_check [[ luaL_optint(L, $narg) ]]
-        :check [[ luaL_checkint(L, $narg) ]]
-        :to [[ lua_tointeger(L, $narg) ]]
+        :opt_check { [501] = "(int)luaL_optinteger(L, $narg, $defaultvalue)",
+                     checked = "lua_isnoneornil(L, $narg) ? $defaultvalue"
+                         .." : (int)lbind_checkrange(L, $narg, INT_MIN, INT_MAX)" }
+        :check { [501] = "(int)luaL_checkinteger(L, $narg)",
+                 checked = "(int)lbind_checkrange(L, $narg, INT_MIN, INT_MAX)" }
+        :to { [501] = "(int)lua_tointeger(L, $narg)",
+              [503] = "(int)lua_tointegerx(L, $narg, NULL)" }
     t.intptr = M.type "intptr" :ltype "integer" :ctype "int"
         :arg [[ &$name ]]
         :is [[ lua_isnumber(L, $narg) ]]
         :push [[ lua_pushinteger(L, $name) ]]
         :to [[ lua_tointeger(L, $narg) ]]
-    t.double = M.type "double" :ltype "number"
+    t.double = M.type "double" :ltype "number" :field "LBIND_FNUMBER"
         :is [[ lbind_isnumber(L, $narg) ]]
         :push [[ lua_pushnumber(L, $name) ]]
         :to [[ lua_tonumber(L, $narg) ]]
     t.cstring = M.type "string" :ltype "string" :ctype "const char *"
+        :field "LBIND_FSTRING"
         :decl [[ $type$name ]]
         :is [[ lua_isstring(L, $narg) ]]
         :push [[ lua_pushstring(L, $name) ]]
@@ -200,6 +410,15 @@ function M.basetypes(t)
         :is [[ lua_isstring(L, $narg) ]]
         :push [[ lua_pushlstring(L, $name, ${name}_len) ]]
         :to [[ lua_tolstring(L, $narg, &${name}_len) ]]
+    -- output buffer, filled in place by the callee, set its size in
+    -- post code, e.g. `$name->size = ret`
+    t.buffer = M.type "buffer" :ltype "lbind.buffer" :ctype "lbind_Buffer *"
+        :decl [[ $type$name ]]
+        :arg [[ $name->data, $name->capacity ]]
+        :is [[ lbind_testbuffer(L, $narg) != NULL ]]
+        :push [[ lbind_pushbuffer(L, $name) ]]
+        :check [[ lbind_checkbuffer(L, $narg) ]]
+        :to [[ lbind_testbuffer(L, $narg) ]]
 
     t.char = t.int
 end
@@ -208,24 +427,53 @@ function M.gettype(name)
     return types[name]
 end
 
+-- a trusted argument is converted by the `to` template, and its `is`
+-- template is only checked by lbind_trusted() in debug builds. types
+-- without these templates are checked as usual.
+local function gen_trusted(_, v, narg)
+    local info = v:info()
+    if not (info.is_tpl and info.to_tpl) then return end
+    local isstr = v:gen_is(narg)
+    if v:isopt() then
+        isstr = ("lua_isnoneornil(L, %d) || %s"):format(narg, isstr)
+    end
+    _(("lbind_trusted(L, %s, %d);"):format(isstr, narg))
+    return (v:gen_to(narg))
+end
+
 local function gen_getargs(_, fn, narg, args)
-    local t = {}
+    local t, late = {}, {}
 
     for i, v in ipairs(args) do
         local checkstr, nstack
-        if v:isopt() and v:opt_check() then
+        if fn == 'trusted' then
+            checkstr, nstack = gen_trusted(_, v, narg), v:info().to_nstack
+        end
+        if checkstr then
+            if v:isopt() then
+                checkstr = ("lua_isnoneornil(L, %d) ? %s : %s")
+                    :format(narg, v:optvalue(), checkstr)
+            end
+        elseif v:isopt() and v:opt_check() then
             checkstr, nstack = v:gen_opt_check(narg)
         else
-            checkstr, nstack = v[fn](v, narg)
+            checkstr, nstack = v[fn == 'trusted' and 'gen_check' or fn](v, narg)
             if v:isopt() then
                 checkstr = ("lua_isnoneornil(L, %d) ? %s : %s")
                     :format(narg, checkstr, v:optvalue())
             end
         end
-        _(v:gen_decl(checkstr))";"
+        if v:info().late then
+            late[#late + 1] = v:gen_decl(checkstr)
+        else
+            _(v:gen_decl(checkstr))";"
+        end
         t[#t + 1] = v:gen_arg()
         narg = narg + nstack
     end
+    -- arguments taking resources (callbacks) come last, so no check
+    -- can fail after they are taken
+    for i, decl in ipairs(late) do _(decl)";" end
 
     return t
 end
@@ -238,6 +486,235 @@ function M.gen_checkargs(_, narg, args)
     return gen_getargs(_, 'gen_check', narg, args)
 end
 
+function M.gen_trustedargs(_, narg, args)
+    return gen_getargs(_, 'trusted', narg, args)
+end
+
+-- a function is trusted if it, or the module it's in, sets `trusted`
+function M.gen_args(_, narg, args, trusted)
+    if trusted then
+        return M.gen_trustedargs(_, narg, args)
+    end
+    return M.gen_checkargs(_, narg, args)
+end
+
+-- functions which share a C prototype are bound by one thunk, and found
+-- by index from a function table of it, see gen_thunks(). functions
+-- with C code, overloads or multiple results are not shared, nor are
+-- arguments not passed as is (e.g. `&$name`).
+local function thunkable(fn)
+    local entry = fn[1]
+    if #fn ~= 1 or entry.body or entry.call or entry.prev or entry.post
+            or #(entry.rets or {}) > 1 then
+        return false
+    end
+    for i, v in ipairs(entry.args or {}) do
+        if v:info().arg_tpl ~= "$name" then return false end
+    end
+    return true
+end
+
+-- the key is made of C types, so only functions with the same prototype
+-- (and the same argument checks) share a thunk.
+function M.signature(args, rets, trusted)
+    local function typekey(v)
+        local key = v:ctype()
+        if v:isopt() then key = key.."="..tostring(v:optvalue()) end
+        if v:info().keep then key = key.."!" end
+        return key
+    end
+    local t = {}
+    for i, v in ipairs(args or {}) do t[i] = typekey(v) end
+    local ret = rets and rets[1] and typekey(rets[1]) or "void"
+    return (trusted and "trusted " or "")
+        ..ret.."("..table.concat(t, ",")..")"
+end
+
+-- generate shared thunks of functions, and their lbind_ThunkReg list
+-- `<prefix>_thunks`. only functions marked `exact` are shared: they are
+-- called through a pointer of the prototype their types declare, which
+-- must be the C prototype exactly (not a macro, no `long` for `int`).
+-- `trusted` is set if the module is trusted. returns the functions
+-- can't be shared, which need a binding of their own.
+function M.gen_thunks(_, prefix, funcs, trusted)
+    local groups, order, rest = {}, {}, {}
+    for i, fn in ipairs(funcs) do
+        if fn.exact and thunkable(fn) then
+            local sig = M.signature(fn[1].args, fn[1].rets,
+                fn.trusted or trusted)
+            if not groups[sig] then
+                groups[sig] = {}
+                order[#order+1] = sig
+            end
+            local g = groups[sig]
+            g[#g+1] = fn
+        else
+            rest[#rest+1] = fn
+        end
+    end
+
+    for k, sig in ipairs(order) do
+        local g, name = groups[sig], prefix.."_"..k
+        local entry = g[1][1]
+        local args, rets = entry.args or {}, entry.rets or {}
+        local trust = g[1].trusted or trusted
+        local params = {}
+        for i, v in ipairs(args) do params[i] = v:ctype() end
+        local ret = rets[1] and rets[1]:ref "r"
+        local rtype = ret and ret:ctype() or "void"
+
+        _("/* "..sig.." */")
+        _(("typedef %s (*%s_t)(%s);"):format(rtype, name,
+            #params == 0 and "void" or table.concat(params, ", ")))
+        _(("static const %s_t %s_funcs[] = {"):format(name, name))
+        _(4)
+        for i, fn in ipairs(g) do
+            _((fn.cname or fn.name)..",")
+        end
+        _(-4)"};"
+        _(("static int %s(lua_State *L) {"):format(name))
+        _(4)
+        M.gen_checkstack(_, args, rets)
+        local names = M.gen_args(_, 1, args, trust)
+        local call = ("%s_funcs[lbind_thunkindex(L)](%s)")
+            :format(name, table.concat(names, ", "))
+        if ret then
+            local pushstr, nstack = ret:gen_push()
+            _((ret:gen_decl(call)))";"
+            M.gen_postargs(_, args)
+            _(pushstr)";"
+            _("return "..(nstack or 1)..";")
+        else
+            _(call..";")
+            M.gen_postargs(_, args)
+            _"return 0;"
+        end
+        _(-4)"}"
+        _""
+    end
+
+    _(("static const lbind_ThunkReg %s_thunks[] = {"):format(prefix))
+    _(4)
+    for k, sig in ipairs(order) do
+        for i, fn in ipairs(groups[sig]) do
+            _(("{ %q, %s_%d, %d },"):format(fn.lname or fn.name,
+                prefix, k, i-1))
+        end
+    end
+    _"{ NULL, NULL, 0 }"
+    _(-4)"};"
+    return rest
+end
+
+-- generate a async binding of a function: its arguments are converted
+-- into a job, the function is called by `work` in a executor, and the
+-- coroutine is resumed with the result by `finish`, see lbind_await().
+-- like thunks, arguments must be passed as is, and C code is not
+-- supported here.
+function M.gen_async(_, prefix, fn)
+    assert(thunkable(fn), "function '"..fn.name.."' can't be async")
+    local entry = fn[1]
+    local args, rets = entry.args or {}, entry.rets or {}
+    -- the executor would call them off the thread of their state
+    for i, v in ipairs(args) do
+        assert(not v:info().cbname, "function '"..fn.name
+            .."' can't be async, it takes a callback")
+    end
+    local ret = rets[1] and rets[1]:ref "r"
+    local jtype = prefix.."_job"
+
+    local function member(v)
+        return utils.template(v:info().decl_tpl, v:info())
+    end
+    local function field(v)
+        return setmetatable({ name = "j->"..v:name() },
+            { __index = v:info() })
+    end
+
+    _"typedef struct {"
+    _(4)
+    for i, v in ipairs(args) do _(member(v))";" end
+    if ret then _(member(ret))";" end
+    _(-4)("} "..jtype..";")
+    _""
+    local names = {}
+    for i, v in ipairs(args) do names[i] = "j->"..v:name() end
+    local call = (fn.cname or fn.name).."("..table.concat(names, ", ")..")"
+    _(("static void %s_work(void *data) {"):format(prefix))
+    _(4)
+    _(jtype.." *j = ("..jtype.."*)data;")
+    _(ret and "j->"..ret:name().." = "..call..";" or call..";")
+    _(-4)"}"
+    _""
+    local posts = false
+    for i, v in ipairs(args) do posts = posts or v:gen_post() ~= nil end
+    _(("static int %s_finish(lua_State *L, void *data) {"):format(prefix))
+    _(4)
+    if ret or posts then
+        _(jtype.." *j = ("..jtype.."*)data;")
+    end
+    M.gen_postargs(_, args, field)
+    M.gen_checkstack(_, {}, rets)
+    if ret then
+        _(utils.template(config.template(ret:info().push_tpl), field(ret)))";"
+        _("return "..(ret:info().push_nstack or 1)..";")
+    else
+        _(posts and "(void)L;" or "(void)L; (void)data;")
+        _"return 0;"
+    end
+    _(-4)"}"
+    _""
+    _(("static int %s(lua_State *L) {"):format(prefix))
+    _(4)
+    M.gen_checkstack(_, args)
+    local locals = M.gen_checkargs(_, 1, args)
+    _(("%s *j = (%s*)lbind_newjob(L, sizeof(%s), %s_work, %s_finish);")
+        :format(jtype, jtype, jtype, prefix, prefix))
+    for i, v in ipairs(args) do
+        _("j->"..v:name().." = "..locals[i]..";")
+    end
+    _"return lbind_await(L, j);"
+    _(-4)"}"
+end
+
+-- Lua guarantees LUA_MINSTACK free slots when a C function is called
+M.minstack = 20
+
+-- stack slots a binding uses above its arguments: all pushed results,
+-- plus the most temporary slots any conversion needs (see t:stack()).
+function M.stack_budget(args, rets, extra)
+    local n, tmp = extra or 0, 0
+    for i, v in ipairs(args) do
+        tmp = math.max(tmp, v:info().stack or 0)
+    end
+    for i, v in ipairs(rets or {}) do
+        n = n + (v:info().push_nstack or 1)
+    end
+    return n + tmp
+end
+
+-- reserve the whole budget of a binding once, so the conversions and
+-- the fast runtime helpers needn't check the stack again.
+function M.gen_checkstack(_, args, rets, extra)
+    local n = M.stack_budget(args, rets, extra)
+    if n > M.minstack then
+        _(("luaL_checkstack(L, %d, \"too many results\");"):format(n))
+    end
+    return n
+end
+
+-- emit the post code of arguments, `field` maps a argument to the
+-- info its template is expanded with (e.g. a member of a job).
+function M.gen_postargs(_, args, field)
+    for i, v in ipairs(args) do
+        local post = v:gen_post()
+        if post and field then
+            post = utils.template(config.template(v:info().post_tpl), field(v))
+        end
+        if post then _(post)";" end
+    end
+end
+
 function M.gen_pushargs(_, args)
     local count = 0
     for i, v in ipairs(args) do
@@ -248,4 +725,30 @@ function M.gen_pushargs(_, args)
     return count
 end
 
+-- push the results, and move them into the table on `narg` if caller
+-- gives one, so loops can reuse a single result table. `named` stores
+-- them by their names, instead of by position.
+function M.gen_pushresults(_, rets, narg, named)
+    local count = M.gen_pushargs(_, rets)
+    if not narg then
+        _("return "..count..";")
+        return count
+    end
+    local keys = "NULL"
+    if named then
+        local names = {}
+        for i, v in ipairs(rets) do
+            assert(v:info().push_nstack == 1,
+                "named results must push one value each")
+            names[i] = ("%q, "):format(v:name())
+        end
+        _("static const char *const keys[] = { "..table.concat(names).."NULL };")
+        keys = "keys"
+    end
+    _(("if (lua_istable(L, %d)) return lbind_resulttable(L, %d, %d, %s);")
+        :format(narg, narg, count, keys))
+    _("return "..count..";")
+    return count
+end
+
 return M
@@ -1,5 +1,6 @@
 package.path = package.path .. ";../?.lua"
 local utils = require 'lbind.utils'
+local config = require 'lbind.config'
 local M = {}
 local T = {}
 
@@ -42,15 +43,19 @@ local function stringmethod(name)
     end
 end
 
+-- a template can be a table of templates keyed by target Lua version,
+-- with an optional "checked" entry, see config.template()
+local trimtemplate = utils.trimtemplate
+
 local function templatemethod(name)
     return function(self, nstack)
-        if type(nstack) == 'string' then
-            self[name.."_tpl"] = utils.trim(nstack)
+        if type(nstack) ~= 'number' then
+            self[name.."_tpl"] = trimtemplate(nstack)
             self[name.."_nstack"] = 1
             return self
         end
         return function(s)
-            self[name.."_tpl"] = utils.trim(s)
+            self[name.."_tpl"] = trimtemplate(s)
             self[name.."_nstack"] = nstack
             return self
         end
@@ -125,6 +130,11 @@ function typeMT:set(key)
     return self
 end
 
+-- pick the template for the configured target, see config.template()
+function typeMT:template(name)
+    return config.template(self[name.."_tpl"])
+end
+
 varMT = {
     const    =   boolmethod 'is_const',
     volatile =   boolmethod 'is_volatile',
@@ -143,19 +153,47 @@ function typeMT:__call(name, tag)
     }, varMT)
 end
 
-local function inttype(name, ctype)
+-- `min` and `max` are given to types narrower than lua_Integer, their
+-- checked conversion tests the range.
+local function inttype(name, ctype, min, max)
+    local check = "($ctype)luaL_checkinteger(L, $narg)"
     return typedecl(name)
         :ctype(ctype or name)
         :ltype "integer"
-        :is "lua_isnumber(L, $narg)"
+        -- lua_isinteger only tests the tag, no conversion
+        -- accepts what luaL_checkinteger accepts, e.g. 3.0 and "3"
+        :is { [501] = "lua_isnumber(L, $narg)",
+              [503] = "lbind_isinteger(L, $narg)" }
         :push "lua_pushinteger(L, $name)"
-        :opt "luaL_optint(L, $narg, $defaultvalue)"
-        :check "luaL_checkint(L, $narg)"
-        :to "($ctype)lua_tointeger(L, $narg)"
+        :opt "($ctype)luaL_optinteger(L, $narg, $defaultvalue)"
+        :check { [501] = check, checked = min and
+            ("($ctype)lbind_checkrange(L, $narg, %s, %s)"):format(min, max) }
+        :to { [501] = "($ctype)lua_tointeger(L, $narg)",
+              [503] = "($ctype)lua_tointegerx(L, $narg, NULL)" }
+end
+
+-- 64-bit integers are exact only from 5.3, before that lua_Integer
+-- may be narrower than lua_Number, so go through lua_Number directly.
+local function int64type(name, min, max)
+    local range = min and
+        ("($ctype)lbind_checkrange(L, $narg, %s, %s)"):format(min, max)
+    return inttype(name)
+        :push { [501] = "lua_pushnumber(L, (lua_Number)$name)",
+                [503] = "lua_pushinteger(L, (lua_Integer)$name)" }
+        :opt { [501] = "($ctype)luaL_optnumber(L, $narg, $defaultvalue)",
+               [503] = "($ctype)luaL_optinteger(L, $narg, $defaultvalue)" }
+        :check { [501] = "($ctype)luaL_checknumber(L, $narg)",
+                 [503] = "($ctype)luaL_checkinteger(L, $narg)",
+                 checked = range }
+        :to { [501] = "($ctype)lua_tonumber(L, $narg)",
+              [503] = "($ctype)lua_tointegerx(L, $narg, NULL)" }
 end
 
 local function fixinttype(len, u)
-    return inttype((u or "").."int"..len.."_t")
+    local name = (u or "").."int"..len.."_t"
+    if len == 64 then return int64type(name, u and "0", "UINT64_MAX") end
+    local max = (u or ""):upper().."INT"..len.."_MAX"
+    return inttype(name, name, u and "0" or "INT"..len.."_MIN", max)
 end
 
 local function numbertype(name, ctype)
@@ -181,20 +219,27 @@ local function stringtype(name, ctype)
 end
 
 local function classtype(name, ctype)
-    local t = typedecl(name):ctype(ctype or name)
+    -- by-value results are constructed into the object by lbind_copy,
+    -- using the size/copy hooks of the lbind_Type $lbtype.
+    local t = typedecl(name)
+        :ctype(ctype or name)
+        :set "lbtype" ("lbT_"..name)
+        :push "lbind_copy(L, &$name, &$lbtype)"
+        :check "*($ctype*)lbind_check(L, $narg, &$lbtype)"
+        :to "*($ctype*)lbind_object(L, $narg)"
     return t
 end
 
 -- C part
-inttype "char"            :ctype "char"
-inttype "uchar"           :ctype "unsigned char"
-inttype "short"           :ctype "short int"
-inttype "ushort"          :ctype "unsigned short int"
-inttype "int"             :ctype "int"
-inttype "uint"            :ctype "unsigned int"
+inttype("char",   "char",               "CHAR_MIN", "CHAR_MAX")
+inttype("uchar",  "unsigned char",      "0",        "UCHAR_MAX")
+inttype("short",  "short int",          "SHRT_MIN", "SHRT_MAX")
+inttype("ushort", "unsigned short int", "0",        "USHRT_MAX")
+inttype("int",    "int",                "INT_MIN",  "INT_MAX")
+inttype("uint",   "unsigned int",       "0",        "UINT_MAX")
 inttype "long"            :ctype "long int"
-inttype "ulong"           :ctype "unsigned long int"
-inttype "size_t"
+inttype("ulong",  "unsigned long int",  "0",        "ULONG_MAX")
+inttype("size_t", "size_t",             "0",        "SIZE_MAX")
 inttype "ssize_t"
 fixinttype(8)
 fixinttype(8, "u")
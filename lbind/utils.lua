@@ -138,6 +138,14 @@ local function template(tpl, info, blacklist, cache)
                :gsub("$(%w+)", helper))
 end
 
+-- trim a template, or each one of a table of templates
+function M.trimtemplate(s)
+    if type(s) ~= 'table' then return M.trim(s) end
+    local t = {}
+    for k, v in pairs(s) do t[k] = M.trim(v) end
+    return t
+end
+
 function M.template(tpl, info)
     return template(tpl, info, {}, {})
 end
@@ -5,6 +5,8 @@
 #include <lua.h>
 #include <lauxlib.h>
 
+#include <stddef.h>
+
 
 #if LUA_VERSION_NUM >= 503
 # define lua53_getuservalue lua_getuservalue
@@ -101,13 +103,75 @@ LB_API int lbind_relindex   (int idx, int onstack);
 LB_API int lbind_argferror  (lua_State *L, int idx, const char *fmt, ...);
 LB_API int lbind_typeerror  (lua_State *L, int idx, const char *tname);
 LB_API int lbind_matcherror (lua_State *L, const char *extramsg);
+LB_API lua_Integer lbind_checkrange (lua_State *L, int idx, lua_Number min, lua_Number max);
+LB_API int lbind_isinteger  (lua_State *L, int idx);
 LB_API int lbind_copystack  (lua_State *from, lua_State *to, int nargs);
+LB_API lua_State *lbind_mainthread (lua_State *L);
 LB_API int lbind_hasfield   (lua_State *L, int idx, const char *field);
 LB_API int lbind_self       (lua_State *L, const void *p, const char *method, int nargs, int *ptraceback);
 LB_API int lbind_pcall      (lua_State *L, int nargs, int nrets);
 
+/* `lbind_resulttable` moves the n values on top of stack into the table
+ * on idx, by `keys` (interned once per state), or by 1..n if keys is
+ * NULL, and returns 1 with the table pushed. so bindings with many
+ * results can fill a table given by caller instead of making one. */
+LB_API int lbind_resulttable (lua_State *L, int idx, int n, const char *const *keys);
+
+/* arguments of trusted bindings are converted without checks, in
+ * debug builds (NDEBUG is not defined) they are checked still, the
+ * same way as `luaL_argcheck` does. */
+#ifndef lbind_trusted
+# ifdef NDEBUG
+#   define lbind_trusted(L,cond,idx) ((void)0)
+# else
+#   define lbind_trusted(L,cond,idx) \
+      ((void)((cond) || lbind_argferror((L), (idx), "untrusted argument")))
+# endif
+#endif
+
+/* unchecked variants, for bindings which reserved their stack once with
+ * a single `luaL_checkstack` (or need less than LUA_MINSTACK slots) */
+LB_API int lbind_fastcopystack (lua_State *from, lua_State *to, int nargs);
+LB_API int lbind_fastself      (lua_State *L, const void *p, const char *method, int *ptraceback);
+
+/* `lbind_pushtraceback` pushes the message handler used by
+ * `lbind_pcall` and returns its index, `lbind_pcallh` uses a handler
+ * already on stack, so loops needn't push and remove it every call.
+ */
+LB_API int lbind_pushtraceback (lua_State *L);
+LB_API int lbind_pcallh        (lua_State *L, int nargs, int nrets, int h);
+
+/* yieldable variant of `lbind_pcallh` (Lua 5.2 and later), `k` is
+ * called with `ctx` when the callee yielded and is resumed. */
+#if LUA_VERSION_NUM == 502
+typedef int           lbind_KContext;
+typedef lua_CFunction lbind_KFunction;
+#elif LUA_VERSION_NUM >= 503
+typedef lua_KContext  lbind_KContext;
+typedef lua_KFunction lbind_KFunction;
+#endif
+
+#if LUA_VERSION_NUM >= 502
+LB_API int lbind_pcallk (lua_State *L, int nargs, int nrets, int h, lbind_KContext ctx, lbind_KFunction k);
+#endif
+
 LB_API const char *lbind_dumpstack (lua_State *L, const char *extramsg);
 
+/* lbind lazy error, define LBIND_NO_LAZYERROR to disable this.
+ *
+ * argument errors raised by `lbind_typeerror` and `lbind_check` are
+ * lbind error objects instead of strings: they record the argument
+ * index, the expected and actual type names and where the error
+ * occurs, and format the message only when `tostring` is called on
+ * them. they also have fields `narg`, `expected` and `got`.
+ * The message handler of `lbind_pcall` formats them with a traceback,
+ * as string errors. Lua 5.1 always uses string errors, as its
+ * interpreter can't print other error values.
+ */
+#if LUA_VERSION_NUM < 502 && !defined(LBIND_NO_LAZYERROR)
+# define LBIND_NO_LAZYERROR
+#endif
+
 #define lbind_returnself(L) do { lua_settop((L), 1); return 1; } while (0)
 
 #define lbind_printstack(L, msg) ( printf("%s\n", lbind_dumpstack((L), (msg))), lua_pop((L), 1) )
@@ -139,6 +203,20 @@ LB_API void lbind_setarrayf    (lua_State *L, lua_CFunction f, int field);
 LB_API void lbind_sethashf     (lua_State *L, lua_CFunction f, int field);
 LB_API void lbind_setmaptable  (lua_State *L, luaL_Reg libs[], int field);
 
+/* functions with the same C signature can share one binding (a thunk),
+ * which calls the function at `lbind_thunkindex` in its own function
+ * table. `lbind_setthunks` sets them into the table on top of stack.
+ */
+typedef struct lbind_ThunkReg {
+    const char    *name;
+    lua_CFunction  thunk;
+    int            index; /* index in function table of thunk */
+} lbind_ThunkReg;
+
+#define lbind_thunkindex(L) ((int)lua_tointeger((L), lua_upvalueindex(1)))
+
+LB_API void lbind_setthunks (lua_State *L, const lbind_ThunkReg *l);
+
 #define lbind_checkreadonly(L) ((void)( \
             lua_gettop(L)!=2 &&         \
             luaL_error((L), "field %s is read-only", \
@@ -161,8 +239,13 @@ LB_API void lbind_setlightuservalue (lua_State *L, const void *p);
  * peer table is a normal table that has a field "__peer", t.__peer is
  * the real userdata, in this case, lbind use this table as it is
  * t.__peer. i.e. lbind treat that table as a native object.
+ *
+ * the field is read with rawget, `lbind_setpeer` sets t.__peer to the
+ * value on top of stack and pops it. `lbind_touserdata` never modify
+ * the stack. types with LBIND_NOPEER flag never look for peers.
  */
 LB_API void *lbind_touserdata (lua_State *L, int idx);
+LB_API void  lbind_setpeer    (lua_State *L, int idx);
 
 
 /* lbind class runtime */
@@ -176,12 +259,67 @@ LB_API void *lbind_touserdata (lua_State *L, int idx);
 typedef struct lbind_Type lbind_Type;
 
 typedef void *lbind_Cast(lua_State *L, int idx, const lbind_Type *to_type);
-
+typedef void  lbind_Copy(void *dst, void *src);
+typedef void  lbind_Release(void *holder);
+typedef size_t lbind_Sizeof(void *p);
+
+typedef struct lbind_Writer lbind_Writer;
+typedef void  lbind_Serialize(lua_State *L, void *p, lbind_Writer *w);
+typedef void *lbind_Deserialize(lua_State *L, const char *s, size_t len);
+
+/* a director is a C++ object whose virtual functions can be overridden
+ * in Lua, by assigning a function to a field of the object. `mask` has
+ * bit i set if the i-th name in `virtuals` of its type is overridden,
+ * and `ref` refers a table of the overriding functions, so calls to
+ * virtuals go to C++ directly or to a cached function, without any
+ * method lookup. `lbind_GetDirector` returns the director of a instance,
+ * or NULL if it's not a director.
+ */
+typedef struct lbind_Director {
+    lua_State *L;
+    unsigned long mask;
+    int ref;
+} lbind_Director;
+
+typedef lbind_Director *lbind_GetDirector(void *p);
+
+/* if `size` and `copy` are set, the type is a value type: by-value
+ * returns are constructed in place into the object with `copy` (or
+ * `move`) by `lbind_copy` and `lbind_move`, and destroyed by
+ * `destroy` (may be NULL for plain data).
+ *
+ * `slots` names the fields scripts may store into objects (at most
+ * LBIND_MAXSLOTS), they are kept in user values of the object in Lua
+ * 5.4, so no table is made for them. before 5.4 they go to the
+ * uservalue table under private keys, as other fields do.
+ *
+ * `sizeof_native` returns the native memory owned by a instance, which
+ * Lua can't see. it's credited to the collector when Lua takes the
+ * instance (a tracked wrap, a holder, a value copy, `lbind_track` or
+ * `lbind_credit`), so GC runs as often as the real memory use requires.
+ * the credited amount is kept in the object and given back when it is
+ * deleted, untracked or collected.
+ *
+ * `serialize` writes a instance for `lbind_pack`, and `deserialize`
+ * pushes a new object made from these bytes and returns its instance,
+ * or NULL if the bytes are invalid. value types with the LBIND_POD
+ * flag are plain data and packed as their bytes without hooks.
+ */
 struct lbind_Type {
     const char *name;
     int flags;
     lbind_Cast *cast;
     lbind_Type **bases;
+    size_t size;
+    lbind_Copy *copy;
+    lbind_Copy *move;
+    lbind_Release *destroy;
+    const char **virtuals;
+    lbind_GetDirector *director;
+    const char **slots;
+    lbind_Sizeof *sizeof_native;
+    lbind_Serialize *serialize;
+    lbind_Deserialize *deserialize;
 };
 
 /* lbind type registry
@@ -199,22 +337,59 @@ struct lbind_Type {
  * __newindex, that means the object of this type has the ability to
  * save any value into it's uservalue and can have custom accessors.
  * if a type has base type, it also have LBIND_ACCESSOR flag.
+ *
+ * LBIND_HOLDER is a object flag, not a type flag: the object holds a
+ * reference to the instance (see `lbind_hold`), and releases it
+ * instead of deleting the instance. LBIND_SIZED is a object flag too,
+ * the native size of the instance is credited to the collector.
+ * LBIND_VALUE marks a value object (see `lbind_copy`): the instance
+ * lives in the object itself, `destroy` of its type is called on it
+ * when it's deleted, and `lbind_delete` returns NULL for it.
+ *
+ * LBIND_POD is a type flag: instances are trivially copyable, so they
+ * can be copied as bytes (e.g. by `lbind_pack`). it's never implied by
+ * other fields of the type, set it with `lbind_setpod`.
  */
 #define LBIND_TRACK     0x01
 #define LBIND_INTERN    0x02
 #define LBIND_ACCESSOR  0x04
+#define LBIND_HOLDER    0x08
+#define LBIND_NOPEER    0x10
+#define LBIND_SIZED     0x20
+#define LBIND_POD       0x40
+#define LBIND_VALUE     0x80
 
 #ifndef LBIND_DEFAULT_FLAG
 # define LBIND_DEFAULT_FLAG   (LBIND_TRACK)
 #endif
 
-#define LBIND_INIT(name) { name, LBIND_DEFAULT_FLAG, NULL, NULL }
+#define LBIND_INIT(name) { name, LBIND_DEFAULT_FLAG, NULL, NULL, \
+                           0, NULL, NULL, NULL, NULL, NULL, NULL, NULL, \
+                           NULL, NULL }
 #define LBIND_TYPE(var, name) LB_API lbind_Type var = LBIND_INIT(name)
 
+#ifndef LBIND_MAXSLOTS
+# define LBIND_MAXSLOTS 16
+#endif
+
 LB_API void lbind_inittype  (lbind_Type *t, const char *name);
 LB_API void lbind_setbase   (lbind_Type *t, lbind_Type **bases, lbind_Cast *cast);
 LB_API int  lbind_settrack  (lbind_Type *t, int autotrack);
 LB_API int  lbind_setintern (lbind_Type *t, int autointern);
+LB_API int  lbind_setpod    (lbind_Type *t, int pod);
+LB_API void lbind_setvalue  (lbind_Type *t, size_t size, lbind_Copy *copy, lbind_Copy *move, lbind_Release *destroy);
+LB_API void lbind_setdirector (lbind_Type *t, const char **virtuals, lbind_GetDirector *director);
+LB_API void lbind_setslots    (lbind_Type *t, const char **slots);
+LB_API void lbind_setsizeof   (lbind_Type *t, lbind_Sizeof *sizeof_native);
+LB_API void lbind_setserialize (lbind_Type *t, lbind_Serialize *s, lbind_Deserialize *d);
+
+/* director maintain, objects of director types must be interned.
+ * `lbind_override` pushes the overriding function of i-th virtual and
+ * the object if it's overridden, otherwise returns 0 and caller should
+ * call the C++ implementation. */
+LB_API void lbind_initdirector (lua_State *L, lbind_Director *d);
+LB_API void lbind_freedirector (lbind_Director *d);
+LB_API int  lbind_override     (lbind_Director *d, const void *p, int i);
 
 /* lbind type metatable */
 LB_API int  lbind_newmetatable (lua_State *L, luaL_Reg *libs, const lbind_Type *t);
@@ -229,6 +404,7 @@ LB_API const char *lbind_type      (lua_State *L, int idx);
 
 LB_API int   lbind_isa   (lua_State *L, int idx, const lbind_Type *t);
 LB_API int   lbind_copy  (lua_State *L, const void *p, const lbind_Type *t);
+LB_API int   lbind_move  (lua_State *L, void *p, const lbind_Type *t);
 LB_API void *lbind_cast  (lua_State *L, int idx, const lbind_Type *t);
 LB_API void *lbind_check (lua_State *L, int idx, const lbind_Type *t);
 LB_API void *lbind_test  (lua_State *L, int idx, const lbind_Type *t);
@@ -242,17 +418,37 @@ LB_API void *lbind_test  (lua_State *L, int idx, const lbind_Type *t);
  * `lbind_raw` create a raw lbind object, not associate with a
  * lbind_Type, if `intern` is non-zero, intern it.
  * `lbind_new` create a lbind object associated with a lbind_Type,
- * this type decide whether the object is signed up.
+ * this type decide whether the object is signed up. the instance is
+ * not constructed yet, so call `lbind_credit` after constructing it.
  * `lbind_wrap` wrap a pointer to lbind object associated with
  * lbind_Type, the type decide the signing.
+ * `lbind_hold` wrap a pointer with a shared reference to it, e.g. a
+ * std::shared_ptr or a intrusive refcount. it returns `holdsize`
+ * bytes inside the object to construct the reference in place, and
+ * `release` is called on it when the object is deleted or collected.
+ * the object is never tracked, `lbind_check` still returns p.
  */
+
 LB_API void *lbind_raw  (lua_State *L, size_t objsize, int intern);
 LB_API void *lbind_new  (lua_State *L, size_t objsize, const lbind_Type *t);
 LB_API void *lbind_wrap (lua_State *L, void *p, const lbind_Type *t);
+LB_API void *lbind_hold (lua_State *L, void *p, size_t holdsize, lbind_Release *release, const lbind_Type *t);
+
+/* get the holder storage of a object created by `lbind_hold`, or NULL. */
+LB_API void *lbind_holder (lua_State *L, int idx);
 
 /* delete a lbind object. unsign, clear and remove metatable of it.  */
 LB_API void *lbind_delete (lua_State *L, int idx);
 
+/* release a object now as the collector would do: call its `delete`
+ * if it's tracked, or release its holder. then the object is untracked
+ * and collecting it does nothing. it's the __close metamethod of
+ * tracked types in Lua 5.4, older versions use `lbind.scope(f, ...)`,
+ * which calls f(close, ...), objects passed to close(...) are released
+ * when f returns or raises an error.
+ */
+LB_API void lbind_close (lua_State *L, int idx);
+
 /* get pointer from a lbind object, or NULL. */
 LB_API void *lbind_object (lua_State *L, int idx);
 
@@ -268,6 +464,274 @@ LB_API void lbind_track    (lua_State *L, int idx);
 LB_API void lbind_untrack  (lua_State *L, int idx);
 LB_API int  lbind_hastrack (lua_State *L, int idx);
 
+/* credit the native size of a object to the collector, if its type has
+ * `sizeof_native` and it's not credited yet. objects made by `lbind_new`
+ * call it after the instance is constructed in place. */
+LB_API void lbind_credit   (lua_State *L, int idx);
+
+/* native memory accounting, per lua_State.
+ * `lbind_addmemory` credits (or gives back, if n < 0) native memory to
+ * the collector, a GC step is done every `step` bytes credited, which
+ * `lbind_setgcstep` sets (0 disables stepping, defaults LBIND_GCSTEP).
+ * `lbind_nativememory` returns the native memory credited now.
+ */
+#ifndef LBIND_GCSTEP
+# define LBIND_GCSTEP (1024*1024)
+#endif
+
+LB_API void   lbind_addmemory    (lua_State *L, ptrdiff_t n);
+LB_API void   lbind_setgcstep    (lua_State *L, size_t step);
+LB_API size_t lbind_nativememory (lua_State *L);
+
+
+/* lbind cross-state transfer, define LBIND_NO_TRANSFER to disable this.
+ *
+ * a mailbox is a lock-free queue used to hand native objects between
+ * lua_States, e.g. one state per worker thread. `lbind_transfer`
+ * detaches the object on idx and posts it to the mailbox, the object
+ * is invalidated like `lbind_delete` does. `lbind_receive` pushes a
+ * new object with the same lbind_Type and track/intern flags. the
+ * native object is never copied, so objects stored inline (created by
+ * `lbind_new`) can not be transferred. the type must be registered in
+ * the receiving state, or `lbind_receive` raises an error and keeps the
+ * message.
+ *
+ * a mailbox may have many senders, but only one receiver.
+ * `lbind_freemailbox` drops all messages left, e.g. at shutdown after
+ * senders are stopped, it calls `discard` (if not NULL) on each instance
+ * and returns the number of them.
+ */
+#if !defined(LBIND_NO_TRANSFER) && !defined(__GNUC__) && !defined(_MSC_VER)
+# define LBIND_NO_TRANSFER
+#endif
+
+#ifndef LBIND_NO_TRANSFER
+
+typedef struct lbind_Mailbox {
+    void *head;    /* posted messages, newest first */
+    void *pending; /* received messages, oldest first */
+} lbind_Mailbox;
+
+#define LBIND_MAILBOX_INIT { NULL, NULL }
+
+typedef void lbind_Discard(void *instance, const lbind_Type *t);
+
+LB_API int    lbind_transfer    (lua_State *L, int idx, lbind_Mailbox *mb);
+LB_API int    lbind_receive     (lua_State *L, lbind_Mailbox *mb);
+LB_API size_t lbind_freemailbox (lbind_Mailbox *mb, lbind_Discard *discard);
+
+#endif /* LBIND_NO_TRANSFER */
+
+
+/* lbind async calls, define LBIND_NO_ASYNC to disable this.
+ *
+ * a async binding converts its arguments into a job made by
+ * `lbind_newjob`, and returns `lbind_await`, which hands the job to the
+ * executor set by `lbind_setexecutor` (e.g. a thread pool) and yields
+ * the running coroutine. the executor calls `lbind_runjob` in any
+ * thread, which runs `work` and posts the job to a completion queue of
+ * the state. `lbind_poll` (`lbind.poll()` in Lua) resumes coroutines
+ * of all completed jobs, with the results pushed by `finish`, and
+ * returns the number of them.
+ *
+ * without executor, when the caller can't yield, or before Lua 5.3
+ * (no lua_isyieldable), the job runs at once in the calling thread.
+ * if `finish` raises, the error is raised in the awaiting coroutine. a
+ * coroutine awaiting a job can only be resumed by `lbind_poll`, other
+ * resumes raise an error in it. all jobs must be done before lua_close.
+ */
+#if !defined(LBIND_NO_ASYNC) && defined(LBIND_NO_TRANSFER)
+# define LBIND_NO_ASYNC
+#endif
+
+#ifndef LBIND_NO_ASYNC
+
+typedef union lbind_Job lbind_Job;
+
+typedef void lbind_Work     (void *data);
+typedef int  lbind_Finish   (lua_State *L, void *data);
+typedef void lbind_Executor (void *ud, lbind_Job *job);
+
+LB_API void *lbind_newjob      (lua_State *L, size_t size, lbind_Work *work, lbind_Finish *finish);
+LB_API int   lbind_await       (lua_State *L, void *data);
+LB_API void  lbind_runjob      (lbind_Job *job);
+LB_API void  lbind_setexecutor (lua_State *L, lbind_Executor *e, void *ud);
+LB_API int   lbind_poll        (lua_State *L);
+
+#endif /* LBIND_NO_ASYNC */
+
+
+/* lbind callback runtime
+ *
+ * a C function pointer can't carry a Lua function, so every callback
+ * signature has a fixed pool of generated C thunks (see
+ * `typeinfo.callback`). `lbind_bindcallback` binds a free thunk to the
+ * Lua function on idx and returns it, or NULL if the pool is used up.
+ * `lbind_releasecallback` puts the thunk back when the C side doesn't
+ * use it any more, bindings do it after the call unless the callback
+ * is kept.
+ *
+ * `lbind_checkcallback` is the binding side of it: it raises errors
+ * instead, and leaves a guard on the stack which releases the thunk
+ * when collected, unless the binding has released or kept it
+ * (`lbind_keepcallback`) by then, so errors raised after the thunk is
+ * bound don't leak it.
+ *
+ * thunks call `lbind_pushcallback` to get the bound function on top of
+ * the main thread, with `nstack` more free slots, and call it by
+ * `lbind_callcallback`, which runs it protected: errors are written to
+ * stderr and 0 is returned, the thunk returns a default value then.
+ *
+ * pools are static, so they are shared by every state of the process,
+ * and not synchronized: use a pool from one thread only. a pool is
+ * owned by the state binding its first thunk until all of its thunks
+ * are released, binding it from other states fails meanwhile.
+ */
+typedef void (*lbind_Thunk)(void);
+
+typedef struct lbind_Callback {
+    lua_State *L;   /* main thread of bound function, or NULL */
+    int ref;        /* registry reference of function */
+    int next;       /* next free slot, or -1 */
+    int hash;       /* first slot of thunks hashed here, or -1 */
+    int chain;      /* next slot of the same hash, or -1 */
+    unsigned guard; /* bumped when the slot is released or kept */
+} lbind_Callback;
+
+typedef struct lbind_CallbackPool {
+    const char *name;
+    int size;
+    int used;     /* slots ever used */
+    int freelist; /* first released slot, or -1 */
+    int live;     /* slots bound now */
+    int hashed;   /* thunks are hashed into slots */
+    lua_State *owner; /* main thread of bound functions, or NULL */
+    lbind_Callback *slots;
+    const lbind_Thunk *thunks;
+} lbind_CallbackPool;
+
+#define LBIND_CALLBACKPOOL(name, slots, thunks) \
+    { name, sizeof(thunks)/sizeof((thunks)[0]), 0, -1, 0, 0, NULL, slots, thunks }
+
+LB_API lbind_Thunk lbind_bindcallback    (lua_State *L, int idx, lbind_CallbackPool *pool);
+LB_API lbind_Thunk lbind_checkcallback   (lua_State *L, int idx, lbind_CallbackPool *pool);
+LB_API int         lbind_releasecallback (lbind_CallbackPool *pool, lbind_Thunk f);
+LB_API int         lbind_keepcallback    (lbind_CallbackPool *pool, lbind_Thunk f);
+LB_API lua_State  *lbind_pushcallback    (lbind_CallbackPool *pool, int i, int nstack);
+LB_API int         lbind_callcallback    (lua_State *L, lbind_CallbackPool *pool, int nargs, int nrets);
+
+
+/* lbind buffer runtime, define LBIND_NO_BUFFER to disable this.
+ *
+ * a buffer is a lbind object with `capacity` bytes of inline storage,
+ * bound functions fill it directly, e.g. output parameters of the
+ * shape `(void *buf, size_t len)`, and set `size` to the used bytes.
+ * a slice shares the storage of the buffer it comes from, and it's
+ * converted to Lua string only on demand.
+ */
+#ifndef LBIND_NO_BUFFER
+
+typedef struct lbind_Buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+} lbind_Buffer;
+
+LB_API lbind_Buffer *lbind_newbuffer   (lua_State *L, size_t capacity);
+LB_API lbind_Buffer *lbind_slicebuffer (lua_State *L, int idx, size_t begin, size_t end);
+LB_API lbind_Buffer *lbind_testbuffer  (lua_State *L, int idx);
+LB_API lbind_Buffer *lbind_checkbuffer (lua_State *L, int idx);
+
+#define lbind_pushbuffer(L,b) lua_pushlstring((L), (b)->data, (b)->size)
+
+#endif /* LBIND_NO_BUFFER */
+
+
+/* lbind struct marshaling, define LBIND_NO_STRUCT to disable this.
+ *
+ * a struct is described by a field list ends with a NULL name:
+ *
+ *   static const lbind_Field point_fields[] = {
+ *     LBIND_FIELD(Point, x, LBIND_FNUMBER),
+ *     LBIND_FIELD(Point, y, LBIND_FNUMBER),
+ *     { NULL }
+ *   };
+ *
+ * `lbind_pushstructs` converts a C array to a Lua array of tables,
+ * `lbind_pushcolumns` to a table with one Lua array per field, the
+ * `to` routines do the reverse and return the number of elements
+ * converted. `stride` is the distance in bytes between elements.
+ * strings converted to C are owned by Lua, they are valid as long as
+ * the value converted from is anchored, so only real strings are
+ * accepted, not numbers that would be converted in a temporary slot.
+ *
+ * `lbind_setfields` serves the fields as accessors of the metatable on
+ * top of stack: one table maps names to field entries, and one shared
+ * routine reads or writes the instance by offset, so no C function is
+ * made per field. string fields and the ones marked LBIND_FREADONLY
+ * can't be written, and numeric fields are only written with numbers.
+ * it can't be used with `lbind_sethashf` on the same metamethod.
+ */
+#ifndef LBIND_NO_STRUCT
+
+#define LBIND_FINT    0
+#define LBIND_FUINT   1
+#define LBIND_FNUMBER 2
+#define LBIND_FBOOL   3
+#define LBIND_FSTRING 4
+
+#define LBIND_FKIND     0xFF
+#define LBIND_FREADONLY 0x100
+
+#define LBIND_FIELD(T,f,kind) \
+    { #f, offsetof(T, f), sizeof(((T*)0)->f), (kind) }
+#define LBIND_RFIELD(T,f,kind) LBIND_FIELD(T, f, (kind)|LBIND_FREADONLY)
+
+typedef struct lbind_Field {
+    const char *name;
+    size_t offset;
+    unsigned short size;
+    unsigned short kind;
+} lbind_Field;
+
+LB_API void lbind_pushfield (lua_State *L, const void *p, const lbind_Field *f);
+LB_API void lbind_tofield   (lua_State *L, int idx, void *p, const lbind_Field *f);
+
+LB_API void   lbind_pushstructs (lua_State *L, const void *a, size_t n, size_t stride, const lbind_Field *fields);
+LB_API size_t lbind_tostructs   (lua_State *L, int idx, void *a, size_t n, size_t stride, const lbind_Field *fields);
+LB_API void   lbind_pushcolumns (lua_State *L, const void *a, size_t n, size_t stride, const lbind_Field *fields);
+LB_API size_t lbind_tocolumns   (lua_State *L, int idx, void *a, size_t n, size_t stride, const lbind_Field *fields);
+
+LB_API void lbind_setfields (lua_State *L, const lbind_Field *fields, int field);
+
+#endif /* LBIND_NO_STRUCT */
+
+
+/* lbind numeric array, define LBIND_NO_ARRAY to disable this.
+ *
+ * a flat float/double array kept in lbind object storage, the
+ * elementwise and reduction kernels use SSE2/AVX2 when available
+ * (chosen at runtime), define LBIND_NO_SIMD to use scalar loops only.
+ * `lbind_newarray` returns NULL and pushes nothing if the size of the
+ * array doesn't fit in size_t.
+ */
+#ifndef LBIND_NO_ARRAY
+
+#define LBIND_AFLOAT  0
+#define LBIND_ADOUBLE 1
+
+typedef struct lbind_Array {
+    size_t size;
+    int type;
+    void *data;
+} lbind_Array;
+
+LB_API lbind_Array *lbind_newarray   (lua_State *L, size_t size, int type);
+LB_API lbind_Array *lbind_testarray  (lua_State *L, int idx);
+LB_API lbind_Array *lbind_checkarray (lua_State *L, int idx);
+
+#endif /* LBIND_NO_ARRAY */
+
 
 /* lbind enum runtime */
 #ifndef LBIND_NO_ENUM
@@ -308,6 +772,80 @@ LB_API int lbind_checkmask (lua_State *L, int idx, lbind_Enum *et);
 #endif /* LBIND_NO_ENUM */
 
 
+/* lbind pool allocator, define LBIND_NO_POOL to disable this.
+ *
+ * most lbind userdata are small and of a few fixed sizes (pointer
+ * wrappers, small value objects). the pool is a `lua_Alloc` serving
+ * blocks up to LBIND_POOLMAX bytes from size-class slabs, others go to
+ * the original allocator. a pool belongs to one lua_State (and all its
+ * threads), so it needs no lock.
+ *
+ * create a state with a pool by `lbind_newstate`, or put a pool under
+ * a running state with `lbind_setpool`. `lbind_freepool` frees all
+ * slabs, call it after `lua_close`.
+ *
+ * `hits`/`misses` count allocations served by the pool or not, `inuse`
+ * is the bytes of pool blocks in use, and `reserved` the bytes of all
+ * slabs, so 1 - inuse/reserved is the fragmentation.
+ */
+#ifndef LBIND_NO_POOL
+
+#ifndef LBIND_POOLMAX
+# define LBIND_POOLMAX   128
+#endif
+#ifndef LBIND_POOLSLAB
+# define LBIND_POOLSLAB  16384
+#endif
+
+#define LBIND_POOLALIGN   sizeof(lbind_MaxAlign)
+#define LBIND_POOLCLASSES ((LBIND_POOLMAX+LBIND_POOLALIGN-1)/LBIND_POOLALIGN)
+
+typedef struct lbind_Pool {
+    lua_Alloc f;  /* original allocator */
+    void *ud;
+    void *free[LBIND_POOLCLASSES];  /* free blocks of each class */
+    char *cur[LBIND_POOLCLASSES];   /* unused part of current slab */
+    char *end[LBIND_POOLCLASSES];
+    char **slabs;  /* sorted by address */
+    size_t nslabs, maxslabs;
+    size_t hits, misses, inuse, reserved;
+} lbind_Pool;
+
+LB_API void      lbind_initpool (lbind_Pool *pool, lua_Alloc f, void *ud);
+LB_API void      lbind_freepool (lbind_Pool *pool);
+LB_API void     *lbind_poolalloc (void *ud, void *p, size_t osize, size_t nsize);
+LB_API lua_State *lbind_newstate (lbind_Pool *pool);
+LB_API void      lbind_setpool  (lua_State *L, lbind_Pool *pool);
+
+#endif /* LBIND_NO_POOL */
+
+
+/* lbind binary serialization, define LBIND_NO_PACK to disable this.
+ *
+ * `lbind_pack` pushes a string holding the value on idx, which may be
+ * nil, boolean, number, string, lbind object or a table of them.
+ * `lbind_unpack` pushes the value back. a table or object reached more
+ * than once is packed once, so shared references and cycles are kept.
+ * objects are packed by `serialize` of their type, or as bytes for
+ * value types flagged LBIND_POD, other objects can't be packed. the
+ * format is in native byte order, for processes on the same machine.
+ * tables nested deeper than LBIND_MAXPACKDEPTH can't be packed.
+ *
+ * `serialize` hooks write with `lbind_write`.
+ */
+#ifndef LBIND_NO_PACK
+
+#ifndef LBIND_MAXPACKDEPTH
+# define LBIND_MAXPACKDEPTH 200
+#endif
+
+LB_API void lbind_write  (lbind_Writer *w, const void *s, size_t len);
+LB_API void lbind_pack   (lua_State *L, int idx);
+LB_API int  lbind_unpack (lua_State *L, const char *s, size_t len);
+
+#endif /* LBIND_NO_PACK */
+
+
 LB_NS_END
 
 #endif /* LBIND_H */
@@ -315,8 +853,15 @@ LB_NS_END
 #ifdef LBIND_IMPLEMENTATION
 
 
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if !defined(LBIND_NO_TRANSFER) && defined(_MSC_VER)
+# include <intrin.h>
+#endif
+
 LB_NS_BEGIN
 
 
@@ -451,6 +996,11 @@ static void luaL_traceback(lua_State *L, lua_State *L1, const char *msg, int lev
 #define LBIND_PTRBOX  0x90127B07
 #define LBIND_TYPEBOX 0x799E0B07
 #define LBIND_UDBOX   0xC5E7DB07
+#define LBIND_ERRBOX  0xE7707B07
+#define LBIND_MEMBOX  0x3E3B0B07
+#define LBIND_KEYBOX  0x4E7B0B07
+#define LBIND_MAINBOX 0x3A170B07
+#define LBIND_AWAITBOX 0xA3A17B07
 
 static int lbB_retrieve(lua_State *L, unsigned id) {
   if (lua53_rawgetp(L, LUA_REGISTRYINDEX, (void*)(ptrdiff_t)id) == LUA_TNIL) {
@@ -584,8 +1134,144 @@ LB_API void lbind_requireinto(lua_State *L, const char *prefix, lbind_Reg *libs)
 
 /* lbind utils functions */
 
+/* lbind lazy error */
+#ifndef LBIND_NO_LAZYERROR
+
+#define LBIND_FNAMESIZE 32
+
+/* strings are copied after the struct, as the caller's ones may not
+ * live as long as the error object */
+typedef struct lbind_Error {
+  int narg;
+  int line;
+  const char *expected;
+  const char *got;
+  const char *msg;
+  char fname[LBIND_FNAMESIZE];
+  char where[LUA_IDSIZE];
+} lbind_Error;
+
+static const char *lbR_copy(char **pp, const char *s) {
+  size_t len;
+  char *p = *pp;
+  if (s == NULL) return NULL;
+  len = strlen(s) + 1;
+  memcpy(p, s, len);
+  *pp = p + len;
+  return p;
+}
+
+static lbind_Error *lbR_test(lua_State *L, int idx) {
+  lbind_Error *e = NULL;
+  if (lua_type(L, idx) == LUA_TUSERDATA && lua_getmetatable(L, idx)) {
+    lua53_rawgetp(L, LUA_REGISTRYINDEX, (void*)(ptrdiff_t)LBIND_ERRBOX);
+    if (lua_rawequal(L, -1, -2))
+      e = (lbind_Error*)lua_touserdata(L, idx);
+    lua_pop(L, 2);
+  }
+  return e;
+}
+
+static int lbL_errtostring(lua_State *L) {
+  lbind_Error *e = lbR_test(L, 1);
+  if (e == NULL)
+    return luaL_argerror(L, 1, "lbind error expected");
+  if (e->line > 0)
+    lua_pushfstring(L, "%s:%d: ", e->where, e->line);
+  else
+    lua_pushliteral(L, "");
+  if (e->narg == 0)
+    lua_pushfstring(L, "calling '%s' on bad self (", e->fname);
+  else
+    lua_pushfstring(L, "bad argument #%d to '%s' (", e->narg, e->fname);
+  if (e->msg != NULL)
+    lua_pushstring(L, e->msg);
+  else
+    lua_pushfstring(L, "%s expected, got %s", e->expected, e->got);
+  lua_pushliteral(L, ")");
+  lua_concat(L, 4);
+  return 1;
+}
+
+static int lbL_errindex(lua_State *L) {
+  lbind_Error *e = lbR_test(L, 1);
+  const char *key = lua_tostring(L, 2);
+  if (e == NULL || key == NULL)
+    return 0;
+  if (strcmp(key, "narg") == 0)
+    lua_pushinteger(L, e->narg);
+  else if (strcmp(key, "expected") == 0 && e->expected != NULL)
+    lua_pushstring(L, e->expected);
+  else if (strcmp(key, "got") == 0 && e->got != NULL)
+    lua_pushstring(L, e->got);
+  else
+    return 0;
+  return 1;
+}
+
+static int lbR_argerror(lua_State *L, int narg, const char *expected, const char *msg) {
+  lua_Debug ar;
+  lbind_Error *e;
+  char *p;
+  const char *got = NULL;
+  size_t size = sizeof(lbind_Error);
+  if (narg < 0 && narg > LUA_REGISTRYINDEX)
+    narg += lua_gettop(L) + 1;
+  if (expected != NULL && (got = lbind_type(L, narg)) == NULL)
+    got = luaL_typename(L, narg);
+  if (expected != NULL) size += strlen(expected) + 1;
+  if (got != NULL)      size += strlen(got) + 1;
+  if (msg != NULL)      size += strlen(msg) + 1;
+  e = (lbind_Error*)lua_newuserdata(L, size);
+  p = (char*)(e + 1);
+  e->narg = narg;
+  e->line = 0;
+  e->expected = lbR_copy(&p, expected);
+  e->got = lbR_copy(&p, got);
+  e->msg = lbR_copy(&p, msg);
+  e->fname[0] = '?';
+  e->fname[1] = '\0';
+  if (lua_getstack(L, 0, &ar)) {
+    lua_getinfo(L, "n", &ar);
+    if (ar.namewhat != NULL && strcmp(ar.namewhat, "method") == 0)
+      --e->narg;
+    if (ar.name != NULL) {
+      strncpy(e->fname, ar.name, LBIND_FNAMESIZE-1);
+      e->fname[LBIND_FNAMESIZE-1] = '\0';
+    }
+  }
+  if (lua_getstack(L, 1, &ar)) {
+    lua_getinfo(L, "Sl", &ar);
+    memcpy(e->where, ar.short_src, LUA_IDSIZE);
+    e->line = ar.currentline;
+  }
+  if (lbB_retrieve(L, LBIND_ERRBOX)) {
+    lua_pushcfunction(L, lbL_errtostring);
+    lua_setfield(L, -2, "__tostring");
+    lua_pushcfunction(L, lbL_errindex);
+    lua_setfield(L, -2, "__index");
+  }
+  lua_setmetatable(L, -2);
+  return lua_error(L);
+}
+
+#define lbR_error(L,narg,msg) lbR_argerror((L),(narg),NULL,(msg))
+
+#else
+
+#define lbR_error luaL_argerror
+
+#endif /* LBIND_NO_LAZYERROR */
+
 static int lbL_traceback(lua_State *L) {
   const char *msg = lua_tostring(L, 1);
+#ifndef LBIND_NO_LAZYERROR
+  if (msg == NULL && lbR_test(L, 1) != NULL) {
+    lbL_errtostring(L);
+    lua_replace(L, 1);
+    msg = lua_tostring(L, 1);
+  }
+#endif
   if (msg)
     luaL_traceback(L, L, msg, 1);
   else if (!lua_isnoneornil(L, 1)) {  /* is there an error object? */
@@ -611,9 +1297,31 @@ LB_API int lbind_argferror(lua_State *L, int idx, const char *fmt, ...) {
 }
 
 LB_API int lbind_typeerror(lua_State *L, int idx, const char *tname) {
+#ifndef LBIND_NO_LAZYERROR
+  return lbR_argerror(L, idx, tname, NULL);
+#else
   const char *real_type = lbind_type(L, idx);
   return lbind_argferror(L, idx, "%s expected, got %s", tname,
       real_type != NULL ? real_type : luaL_typename(L, idx));
+#endif
+}
+
+LB_API int lbind_isinteger(lua_State *L, int idx) {
+  /* the values luaL_checkinteger accepts, e.g. 3.0 and "3" */
+#if LUA_VERSION_NUM >= 503
+  int isint;
+  lua_tointegerx(L, idx, &isint);
+  return isint;
+#else
+  return lua_isnumber(L, idx);
+#endif
+}
+
+LB_API lua_Integer lbind_checkrange(lua_State *L, int idx, lua_Number min, lua_Number max) {
+  lua_Integer v = luaL_checkinteger(L, idx);
+  if ((lua_Number)v < min || (lua_Number)v > max)
+    lbR_error(L, idx, "integer out of range");
+  return v;
 }
 
 LB_API int lbind_matcherror(lua_State *L, const char *extramsg) {
@@ -625,15 +1333,44 @@ LB_API int lbind_matcherror(lua_State *L, const char *extramsg) {
       "candidates are:\n%s", ar.name, extramsg);
 }
 
-LB_API int lbind_copystack(lua_State *from, lua_State *to, int n) {
+LB_API int lbind_fastcopystack(lua_State *from, lua_State *to, int n) {
     int i;
-    luaL_checkstack(from, n, "too many args");
     for (i = 0; i < n; ++i)
         lua_pushvalue(from, -n);
     lua_xmove(from, to, n);
     return n;
 }
 
+LB_API int lbind_copystack(lua_State *from, lua_State *to, int n) {
+    luaL_checkstack(from, n, "too many args");
+    return lbind_fastcopystack(from, to, n);
+}
+
+/* states kept by C side (directors, callbacks) must outlive the
+ * coroutine that created them, so they use the main thread. Lua 5.1
+ * has no LUA_RIDX_MAINTHREAD, the main thread is anchored the first
+ * time it calls here (luaopen_lbind does) */
+LB_API lua_State *lbind_mainthread(lua_State *L) {
+  lua_State *L1;
+#if LUA_VERSION_NUM >= 502
+  lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+#else
+  lua_rawgetp(L, LUA_REGISTRYINDEX, (void*)(ptrdiff_t)LBIND_MAINBOX);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    if (!lua_pushthread(L)) {
+      lua_pop(L, 1);
+      return L;
+    }
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, (void*)(ptrdiff_t)LBIND_MAINBOX);
+  }
+#endif
+  L1 = lua_tothread(L, -1);
+  lua_pop(L, 1);
+  return L1;
+}
+
 LB_API const char *lbind_dumpstack(lua_State *L, const char *msg) {
   int i, top = lua_gettop(L);
   luaL_Buffer b;
@@ -659,8 +1396,49 @@ LB_API int lbind_hasfield(lua_State *L, int idx, const char *field) {
   return hasfield;
 }
 
+static void lbR_pushkeys(lua_State *L, const char *const *keys, int n) {
+  /* keys are cached by address of the key list */
+  int i;
+  lbB_retrieve(L, LBIND_KEYBOX); /* 1 */
+  if (lua53_rawgetp(L, -1, keys) == LUA_TNIL) { /* 2 */
+    lua_pop(L, 1); /* (2) */
+    lua_createtable(L, n, 0); /* 2 */
+    for (i = 0; i < n; ++i) {
+      lua_pushstring(L, keys[i]); /* 3 */
+      lua_rawseti(L, -2, i+1); /* 3->2 */
+    }
+    lua_pushvalue(L, -1); /* 3 */
+    lua_rawsetp(L, -3, keys); /* 3->1 */
+  }
+  lua_remove(L, -2); /* (1) */
+}
+
+LB_API int lbind_resulttable(lua_State *L, int idx, int n, const char *const *keys) {
+  int i, top = lua_gettop(L);
+  if (idx < 0 && idx > LUA_REGISTRYINDEX) idx += top + 1;
+  if (keys == NULL) {
+    for (i = n; i > 0; --i)
+      lua_rawseti(L, idx, i);
+  }
+  else {
+    lbR_pushkeys(L, keys, n); /* 1 */
+    for (i = 1; i <= n; ++i) {
+      lua_rawgeti(L, -1, i); /* 2 */
+      lua_pushvalue(L, top-n+i); /* 3 */
+      lua_rawset(L, idx); /* 2,3->idx */
+    }
+  }
+  lua_settop(L, top-n);
+  lua_pushvalue(L, idx);
+  return 1;
+}
+
 LB_API int lbind_self(lua_State *L, const void *p, const char *method, int nargs, int *ptraceback) {
   luaL_checkstack(L, nargs+3, "too many arguments to self call");
+  return lbind_fastself(L, p, method, ptraceback);
+}
+
+LB_API int lbind_fastself(lua_State *L, const void *p, const char *method, int *ptraceback) {
   if (!lbind_retrieve(L, p)) return 0; /* 1 */
   if (lua53_getfield(L, -1, method) == LUA_TNIL) { /* 2 */
     lua_pop(L, 2);
@@ -676,6 +1454,21 @@ LB_API int lbind_self(lua_State *L, const void *p, const char *method, int nargs
   return 1;
 }
 
+LB_API int lbind_pushtraceback(lua_State *L) {
+  lua_pushcfunction(L, lbL_traceback);
+  return lua_gettop(L);
+}
+
+LB_API int lbind_pcallh(lua_State *L, int nargs, int nrets, int h) {
+  return lua_pcall(L, nargs, nrets, h);
+}
+
+#if LUA_VERSION_NUM >= 502
+LB_API int lbind_pcallk(lua_State *L, int nargs, int nrets, int h, lbind_KContext ctx, lbind_KFunction k) {
+  return lua_pcallk(L, nargs, nrets, h, ctx, k);
+}
+#endif
+
 LB_API int lbind_pcall(lua_State *L, int nargs, int nrets) {
   int res, tb_idx;
   lua_pushcfunction(L, lbL_traceback);
@@ -687,6 +1480,68 @@ LB_API int lbind_pcall(lua_State *L, int nargs, int nrets) {
 }
 
 
+/* lbind director support */
+
+#define LBIND_MAXVIRTUALS ((int)sizeof(unsigned long)*8)
+
+LB_API void lbind_initdirector(lua_State *L, lbind_Director *d) {
+  d->L = lbind_mainthread(L);
+  d->mask = 0;
+  d->ref = LUA_NOREF;
+}
+
+LB_API void lbind_freedirector(lbind_Director *d) {
+  if (d->ref != LUA_NOREF)
+    luaL_unref(d->L, LUA_REGISTRYINDEX, d->ref);
+  d->mask = 0;
+  d->ref = LUA_NOREF;
+}
+
+LB_API int lbind_override(lbind_Director *d, const void *p, int i) {
+  lua_State *L = d->L;
+  if (i >= LBIND_MAXVIRTUALS || (d->mask & (1ul << i)) == 0)
+    return 0;
+  luaL_checkstack(L, 3, "no space for override call");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, d->ref); /* 1 */
+  lua_rawgeti(L, -1, i+1); /* 2 */
+  lua_remove(L, -2); /* (1) */
+  if (!lbind_retrieve(L, p)) { /* 2 */
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+static void lbM_override(lua_State *L, const lbind_Type *t) {
+  /* stack: object key value, update director on new field */
+  lbind_Director *d;
+  const char *key, **names;
+  int i;
+  if (t->virtuals == NULL || t->director == NULL
+      || lua_type(L, 2) != LUA_TSTRING)
+    return;
+  key = lua_tostring(L, 2);
+  for (i = 0, names = t->virtuals; *names != NULL; ++i, ++names)
+    if (strcmp(*names, key) == 0) break;
+  if (*names == NULL || i >= LBIND_MAXVIRTUALS
+      || (d = t->director(lbind_object(L, 1))) == NULL)
+    return;
+  if (!lua_isfunction(L, 3))
+    d->mask &= ~(1ul << i);
+  else {
+    if (d->ref == LUA_NOREF) {
+      lua_newtable(L);
+      d->ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, d->ref);
+    lua_pushvalue(L, 3);
+    lua_rawseti(L, -2, i+1);
+    lua_pop(L, 1);
+    d->mask |= 1ul << i;
+  }
+}
+
+
 /* metatable utils */
 
 static int lbL_libcall(lua_State *L) {
@@ -709,6 +1564,28 @@ static int lbM_callacc(lua_State *L, int idx, int nargs) {
   return -1;
 }
 
+#ifndef LBIND_NO_STRUCT
+static int lbM_callfield(lua_State *L, const lbind_Field *f, int nargs) {
+  void *p = lbind_object(L, 1);
+  if (p == NULL)
+    return luaL_error(L, "field %s of invalid object", f->name);
+  if (nargs == 2) {
+    lbind_pushfield(L, p, f);
+    return 1;
+  }
+  if ((f->kind & LBIND_FREADONLY) != 0
+      || (f->kind & LBIND_FKIND) == LBIND_FSTRING)
+    return luaL_argerror(L, 2,
+        lua_pushfstring(L, "field %s is read-only", f->name));
+  switch (f->kind & LBIND_FKIND) {
+  case LBIND_FINT: case LBIND_FUINT: luaL_checkinteger(L, 3); break;
+  case LBIND_FNUMBER: luaL_checknumber(L, 3); break;
+  }
+  lbind_tofield(L, 3, p, f);
+  return 0;
+}
+#endif /* LBIND_NO_STRUCT */
+
 static int lbM_calllut(lua_State *L, int idx, int nargs) {
   lua_CFunction f = lua_tocfunction(L, idx);
   /* look up table */
@@ -716,6 +1593,12 @@ static int lbM_calllut(lua_State *L, int idx, int nargs) {
     lua_pushvalue(L, 2);
     lua_rawget(L, lbind_relindex(idx, 1));
     f = lua_tocfunction(L, -1);
+#ifndef LBIND_NO_STRUCT
+    /* field entries from `lbind_setfields` */
+    if (f == NULL && lua_islightuserdata(L, -1))
+      return lbM_callfield(L, (const lbind_Field*)lua_touserdata(L, -1),
+          nargs);
+#endif
   }
   if (f != NULL) {
     lua_settop(L, nargs);
@@ -724,26 +1607,95 @@ static int lbM_calllut(lua_State *L, int idx, int nargs) {
   return -1;
 }
 
-static int lbL_newindex(lua_State *L) {
-  int nret;
-  /* upvalue: seti, seth 
-   * order:
-   *  - lut
-   *  - accessor
-   *  - normaltable
-   *  - uservalue
-   */
-  if (!lua_isnone(L, lua_upvalueindex(1)) &&
-      (nret = lbM_calllut(L, lua_upvalueindex(1), 3)) >= 0)
-    return nret;
-  if (!lua_isnone(L, lua_upvalueindex(2)) &&
-      (nret = lbM_callacc(L, lua_upvalueindex(2), 3)) >= 0)
-    return nret;
-  if (!lua_isuserdata(L, 1)) {
-    lua_settop(L, 3);
-    lua_rawset(L, 1);
+/* metatable maps slot names to addresses in lbV_marks */
+static char lbV_marks[LBIND_MAXSLOTS];
+
+static int lbV_count(const lbind_Type *t) {
+  int n = 0;
+  if (t != NULL && t->slots != NULL)
+    while (n < LBIND_MAXSLOTS && t->slots[n] != NULL)
+      ++n;
+  return n;
+}
+
+static int lbV_slot(lua_State *L, int idx) {
+  const char *p = (const char*)lua_touserdata(L, idx);
+  if (lua_islightuserdata(L, idx)
+      && p >= lbV_marks && p < lbV_marks + LBIND_MAXSLOTS)
+    return (int)(p - lbV_marks) + 1;
+  return 0;
+}
+
+/* slots live in user values on 5.4. before 5.4, and for objects not
+ * made with enough user values (e.g. lbind_raw), they live in the
+ * uservalue table keyed by their marks, which scripts can't make */
+static int lbV_getslot(lua_State *L, int slot) {
+  /* stack: object ... */
+#if LUA_VERSION_NUM >= 504
+  if (lua_getiuservalue(L, 1, slot+1) != LUA_TNONE)
+    return 1;
+  lua_pop(L, 1);
+#endif
+  if (lua53_getuservalue(L, 1) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_pushnil(L);
+    return 1;
+  }
+  lua53_rawgetp(L, -1, &lbV_marks[slot-1]);
+  lua_remove(L, -2);
+  return 1;
+}
+
+static void lbV_setslot(lua_State *L, int slot) {
+  /* stack: object key value ... */
+#if LUA_VERSION_NUM >= 504
+  lua_pushvalue(L, 3);
+  if (lua_setiuservalue(L, 1, slot+1))
+    return;
+#endif
+  if (lua53_getuservalue(L, 1) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setuservalue(L, 1);
+  }
+  lua_pushvalue(L, 3);
+  lua_rawsetp(L, -2, &lbV_marks[slot-1]);
+  lua_pop(L, 1);
+}
+
+static int lbL_newindex(lua_State *L) {
+  int nret, slot;
+  /* upvalue: seti, seth, director type
+   * order:
+   *  - lut
+   *  - accessor
+   *  - normaltable
+   *  - uservalue
+   */
+  if (!lua_isnoneornil(L, lua_upvalueindex(1)) &&
+      (nret = lbM_calllut(L, lua_upvalueindex(1), 3)) >= 0)
+    return nret;
+  if (!lua_isnone(L, lua_upvalueindex(2)) &&
+      (nret = lbM_callacc(L, lua_upvalueindex(2), 3)) >= 0)
+    return nret;
+  if (!lua_isuserdata(L, 1)) {
+    lua_settop(L, 3);
+    lua_rawset(L, 1);
     return 0;
   }
+  lua_settop(L, 3);
+  if (lua_islightuserdata(L, lua_upvalueindex(3)))
+    lbM_override(L, (const lbind_Type*)lua_touserdata(L, lua_upvalueindex(3)));
+  if (lua_getmetatable(L, 1)) { /* 4 */
+    lua_pushvalue(L, 2); /* 5 */
+    lua53_rawget(L, 4); /* 5->5 */
+    if ((slot = lbV_slot(L, 5)) != 0) {
+      lbV_setslot(L, slot);
+      return 0;
+    }
+    lua_settop(L, 3);
+  }
   if (lua53_getuservalue(L, 1) == LUA_TNIL) {
     lua_pop(L, 1);
     lua_newtable(L);
@@ -757,28 +1709,39 @@ static int lbL_newindex(lua_State *L) {
 }
 
 static int lbL_index(lua_State *L) {
-  int i, nret;
+  int i, nret, slot;
   /* upvalue: geti, geth, tables
    * order:
+   *  - slots
    *  - uservalue
    *  - metatable
    *  - lut
    *  - accessor
    *  - upvalue tables
    */
+  lua_settop(L, 2);
+  if (lua_getmetatable(L, 1)) { /* 3 */
+    lua_pushvalue(L, 2); /* 4 */
+    lua53_rawget(L, 3); /* 4->4 */
+    if ((slot = lbV_slot(L, 4)) != 0)
+      return lua_isuserdata(L, 1) ? lbV_getslot(L, slot) : 0;
+  }
+  else {
+    lua_pushnil(L); /* 3 */
+    lua_pushnil(L); /* 4 */
+  }
   if (lua_isuserdata(L, 1)) {
-    if (lua53_getuservalue(L, 1) != LUA_TNIL) {
+    if (lua53_getuservalue(L, 1) != LUA_TNIL) { /* 5 */
       lua_pushvalue(L, 2);
       if (lua53_rawget(L, -2) != LUA_TNIL)
         return 1;
     }
   }
-  if (lua_getmetatable(L, 1)) {
-    lua_pushvalue(L, 2);
-    if (lua53_rawget(L, -2) != LUA_TNIL)
-      return 1;
+  if (!lua_isnil(L, 4)) {
+    lua_pushvalue(L, 4);
+    return 1;
   }
-  if (!lua_isnone(L, lua_upvalueindex(1)) &&
+  if (!lua_isnoneornil(L, lua_upvalueindex(1)) &&
       (nret = lbM_calllut(L, lua_upvalueindex(1), 2)) >= 0)
     return nret;
   if (!lua_isnone(L, lua_upvalueindex(2)) &&
@@ -793,7 +1756,10 @@ static int lbL_index(lua_State *L) {
       lua_replace(L, lua_upvalueindex(i));
     }
     lua_pushvalue(L, 2);
-    if (lua53_gettable(L, lua_upvalueindex(i)) != LUA_TNIL)
+    /* slot marks of base types are no values, base slot names of
+     * derived objects are plain fields in the uservalue table */
+    if (lua53_gettable(L, lua_upvalueindex(i)) != LUA_TNIL
+        && lbV_slot(L, -1) == 0)
       return 1;
   }
   return 0;
@@ -802,7 +1768,8 @@ static int lbL_index(lua_State *L) {
 static void lbM_newindex(lua_State *L) {
   lua_pushnil(L);
   lua_pushnil(L);
-  lua_pushcclosure(L, lbL_newindex, 2);
+  lua_pushnil(L);
+  lua_pushcclosure(L, lbL_newindex, 3);
 }
 
 static void lbM_index(lua_State *L, int ntables) {
@@ -897,9 +1864,7 @@ LB_API void lbind_setaccessors(lua_State *L, int ntables, int field) {
     lua_setfield(L, -2, "__index");
   }
   if ((field & LBIND_NEWINDEX) != 0) {
-    lua_pushnil(L);
-    lua_pushnil(L);
-    lua_pushcclosure(L, lbL_newindex, 2);
+    lbM_newindex(L);
     lua_setfield(L, -2, "__newindex");
   }
 }
@@ -930,6 +1895,40 @@ LB_API void lbind_setmaptable(lua_State *L, luaL_Reg libs[], int field) {
   lua_pop(L, 1);
 }
 
+LB_API void lbind_setthunks(lua_State *L, const lbind_ThunkReg *l) {
+  for (; l->name != NULL; ++l) {
+    lua_pushinteger(L, l->index);
+    lua_pushcclosure(L, l->thunk, 1);
+    lua_setfield(L, -2, l->name);
+  }
+}
+
+#ifndef LBIND_NO_STRUCT
+LB_API void lbind_setfields(lua_State *L, const lbind_Field *fields, int field) {
+  int i, which;
+  for (which = LBIND_INDEX; which <= LBIND_NEWINDEX; which <<= 1) {
+    if ((field & which) == 0) continue;
+    get_default_metafield(L, -1, which);
+    /* add entries to the look up table, share one made before */
+    lua_getupvalue(L, -1, 1);
+    if (lua_iscfunction(L, -1))
+      luaL_error(L, "fields can't be set with a hash function (%s)",
+          which == LBIND_INDEX ? "__index" : "__newindex");
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      lua_newtable(L);
+      lua_pushvalue(L, -1);
+      lua_setupvalue(L, -3, 1);
+    }
+    for (i = 0; fields[i].name != NULL; ++i) {
+      lua_pushlightuserdata(L, (void*)&fields[i]);
+      lua_setfield(L, -2, fields[i].name);
+    }
+    lua_pop(L, 2);
+  }
+}
+#endif /* LBIND_NO_STRUCT */
+
 
 /* lbind userdata maintain */
 
@@ -938,25 +1937,155 @@ typedef union {
   struct {
     void *instance;
     int flags;
+    size_t native; /* native size credited, if LBIND_SIZED */
   } o;
 } lbind_Object;
 
+typedef union {
+  lbind_MaxAlign dummy; /* ensures maximum alignment for holder */
+  lbind_Release *release;
+} lbind_Holder;
+
 #define check_size(L,n) (lua_rawlen((L),(n)) >= sizeof(lbind_Object))
+#define lbO_holder(obj) ((lbind_Holder*)((obj)+1))
 
-static lbind_Object *lbO_new(lua_State *L, size_t objsize, int flags) {
+static lbind_Object *lbO_new(lua_State *L, size_t objsize, int flags, int nslots) {
   lbind_Object *obj;
+#if LUA_VERSION_NUM >= 504
+  obj = (lbind_Object*)lua_newuserdatauv(L, sizeof(lbind_Object) + objsize,
+      1 + nslots);
+#else
+  (void)nslots;
   obj = (lbind_Object*)lua_newuserdata(L, sizeof(lbind_Object) + objsize);
+#endif
   obj->o.flags = flags;
   obj->o.instance = (void*)(obj+1);
+  obj->o.native = 0;
   if (objsize != 0 && (flags & LBIND_INTERN) != 0)
     lbind_intern(L, obj->o.instance);
   return obj;
 }
 
+typedef struct lbind_MemStat {
+  size_t total;
+  size_t debt;
+  size_t step;
+} lbind_MemStat;
+
+static lbind_MemStat *lbG_stat(lua_State *L) {
+  lbind_MemStat *ms;
+  void *key = (void*)(ptrdiff_t)LBIND_MEMBOX;
+  if (lua53_rawgetp(L, LUA_REGISTRYINDEX, key) == LUA_TNIL) {
+    lua_pop(L, 1);
+    ms = (lbind_MemStat*)lua_newuserdata(L, sizeof(lbind_MemStat));
+    ms->total = ms->debt = 0;
+    ms->step = LBIND_GCSTEP;
+    lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+    return ms;
+  }
+  ms = (lbind_MemStat*)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return ms;
+}
+
+LB_API void lbind_addmemory(lua_State *L, ptrdiff_t n) {
+  lbind_MemStat *ms = lbG_stat(L);
+  if (n < 0) {
+    size_t m = (size_t)-n;
+    ms->total -= m < ms->total ? m : ms->total;
+    return;
+  }
+  ms->total += (size_t)n;
+  if (ms->step == 0) return;
+  if ((ms->debt += (size_t)n) >= ms->step) {
+    /* pay the debt with a GC step as large as it, in KB */
+    size_t kb = ms->debt / 1024;
+    ms->debt = 0;
+    lua_gc(L, LUA_GCSTEP, kb > INT_MAX ? INT_MAX : (int)kb);
+  }
+}
+
+LB_API void lbind_setgcstep(lua_State *L, size_t step) {
+  lbind_MemStat *ms = lbG_stat(L);
+  ms->step = step;
+  ms->debt = 0;
+}
+
+LB_API size_t lbind_nativememory(lua_State *L) {
+  return lbG_stat(L)->total;
+}
+
+static void lbG_credit(lua_State *L, lbind_Object *obj, const lbind_Type *t) {
+  /* only for objects owning their instance */
+  size_t n;
+  if (t == NULL || t->sizeof_native == NULL || obj->o.instance == NULL
+      || (obj->o.flags & LBIND_SIZED) != 0
+      || (n = t->sizeof_native(obj->o.instance)) == 0)
+    return;
+  obj->o.flags |= LBIND_SIZED;
+  obj->o.native = n;
+  lbind_addmemory(L, (ptrdiff_t)n);
+}
+
+static void lbG_release(lua_State *L, lbind_Object *obj) {
+  if ((obj->o.flags & LBIND_SIZED) == 0) return;
+  obj->o.flags &= ~LBIND_SIZED;
+  lbind_addmemory(L, -(ptrdiff_t)obj->o.native);
+  obj->o.native = 0;
+}
+
+#ifndef LBIND_NO_PEER
+static int lbP_pushpeer(lua_State *L, int idx) {
+  /* stack: peer table at (absolute) idx. not cached, scripts may
+   * change t.__peer at any time */
+  lua_pushliteral(L, "__peer");
+  return lua53_rawget(L, idx) == LUA_TUSERDATA;
+}
+
+LB_API void lbind_setpeer(lua_State *L, int idx) {
+  if (idx < 0 && idx > LUA_REGISTRYINDEX)
+    idx += lua_gettop(L) + 1;
+  lua_pushliteral(L, "__peer");
+  lua_insert(L, -2);
+  lua_rawset(L, idx);
+}
+#else
+LB_API void lbind_setpeer(lua_State *L, int idx) {
+  lua_setfield(L, idx, "__peer");
+}
+#endif /* LBIND_NO_PEER */
+
+static void *lbP_touserdata(lua_State *L, int *pidx, int peer) {
+  /* push the userdata of a peer table and point *pidx to it */
+#ifndef LBIND_NO_PEER
+  if (peer && lua_istable(L, *pidx)) {
+    int idx = *pidx;
+    if (idx < 0 && idx > LUA_REGISTRYINDEX)
+      idx += lua_gettop(L) + 1;
+    if (!lbP_pushpeer(L, idx))
+      return NULL;
+    *pidx = lua_gettop(L);
+  }
+#else
+  (void)peer;
+#endif
+  return lua_touserdata(L, *pidx);
+}
+
+static lbind_Object *lbO_touserdata(lua_State *L, int idx) {
+  /* valid lbind object at idx or its peer, stack unchanged */
+  int top = lua_gettop(L);
+  lbind_Object *obj = (lbind_Object*)lbP_touserdata(L, &idx, 1);
+  if (obj != NULL && !check_size(L, idx))
+    obj = NULL;
+  lua_settop(L, top);
+  return obj;
+}
+
 static lbind_Object *lbO_test(lua_State *L, int idx) {
-  lbind_Object *obj = (lbind_Object*)lbind_touserdata(L, idx);
+  lbind_Object *obj = lbO_touserdata(L, idx);
   if (obj != NULL) {
-    if (!check_size(L, idx) || obj->o.instance == NULL)
+    if (obj->o.instance == NULL)
       obj = NULL;
 #if 0
     else {
@@ -972,45 +2101,62 @@ static lbind_Object *lbO_test(lua_State *L, int idx) {
 }
 
 LB_API void *lbind_touserdata(lua_State *L, int idx) {
-#ifndef LBIND_NO_PEER
-  if (lua_istable(L, idx)) {
-    if (lua53_getfield(L, idx, "__peer") == LUA_TNIL) {
-      lua_pop(L, 1);
-      return NULL;
-    }
-    lua_replace(L, idx);
-  }
-#endif
-  return lua_touserdata(L, idx);
+  int top = lua_gettop(L);
+  void *u = lbP_touserdata(L, &idx, 1);
+  lua_settop(L, top);
+  return u;
 }
 
 LB_API void *lbind_raw(lua_State *L, size_t objsize, int intern) {
-  return lbO_new(L, objsize, intern ? LBIND_INTERN : 0)->o.instance;
+  return lbO_new(L, objsize, intern ? LBIND_INTERN : 0, 0)->o.instance;
 }
 
 LB_API void *lbind_new(lua_State *L, size_t objsize, const lbind_Type *t) {
-  lbind_Object *obj = lbO_new(L, objsize, t->flags);
+  lbind_Object *obj = lbO_new(L, objsize, t->flags, lbV_count(t));
   if (lbind_getmetatable(L, t))
     lua_setmetatable(L, -2);
   return obj->o.instance;
 }
 
 LB_API void *lbind_wrap(lua_State *L, void *p, const lbind_Type *t) {
-  lbind_Object *obj = lbO_new(L, 0, t->flags);
+  lbind_Object *obj = lbO_new(L, 0, t->flags, lbV_count(t));
   obj->o.instance = p;
   if ((obj->o.flags & LBIND_INTERN) != 0)
     lbind_intern(L, p);
   if (lbind_getmetatable(L, t))
     lua_setmetatable(L, -2);
+  if ((obj->o.flags & LBIND_TRACK) != 0)
+    lbG_credit(L, obj, t);
   return p;
 }
 
+LB_API void *lbind_hold(lua_State *L, void *p, size_t holdsize, lbind_Release *release, const lbind_Type *t) {
+  int flags = (t->flags & ~LBIND_TRACK) | LBIND_HOLDER;
+  lbind_Object *obj = lbO_new(L, sizeof(lbind_Holder) + holdsize, 0,
+      lbV_count(t));
+  obj->o.instance = p;
+  if ((flags & LBIND_INTERN) != 0)
+    lbind_intern(L, p);
+  obj->o.flags = flags;
+  lbO_holder(obj)->release = release;
+  if (lbind_getmetatable(L, t))
+    lua_setmetatable(L, -2);
+  lbG_credit(L, obj, t);
+  return (void*)(lbO_holder(obj)+1);
+}
+
+LB_API void *lbind_holder(lua_State *L, int idx) {
+  lbind_Object *obj = lbO_test(L, idx);
+  if (obj == NULL || (obj->o.flags & LBIND_HOLDER) == 0)
+    return NULL;
+  return (void*)(lbO_holder(obj)+1);
+}
+
 LB_API void *lbind_delete(lua_State *L, int idx) {
   void *u = NULL;
-  lbind_Object *obj = (lbind_Object*)lbind_touserdata(L, idx);
+  lbind_Object *obj = lbO_touserdata(L, idx);
   if (obj != NULL) {
-    if (!check_size(L, idx))
-      return NULL;
+    lbG_release(L, obj);
     if ((u = obj->o.instance) != NULL) {
       obj->o.instance = NULL;
       obj->o.flags &= ~LBIND_TRACK;
@@ -1020,6 +2166,20 @@ LB_API void *lbind_delete(lua_State *L, int idx) {
       lua_rawsetp(L, -3, u); /* 2->1 */
       lua_pop(L, 1); /* (1) */
 #endif
+      if ((obj->o.flags & LBIND_HOLDER) != 0) {
+        /* only drop our reference, the instance is not ours */
+        obj->o.flags &= ~LBIND_HOLDER;
+        if (lbO_holder(obj)->release != NULL)
+          lbO_holder(obj)->release((void*)(lbO_holder(obj)+1));
+        u = NULL;
+      }
+      else if ((obj->o.flags & LBIND_VALUE) != 0) {
+        /* the instance is in the object, only destroy it in place */
+        obj->o.flags &= ~LBIND_VALUE;
+        if (u != (void*)(obj+1) && lbO_holder(obj)->release != NULL)
+          lbO_holder(obj)->release(u);
+        u = NULL;
+      }
     }
   }
   return u;
@@ -1051,14 +2211,25 @@ LB_API int lbind_retrieve(lua_State *L, const void *p) {
 
 LB_API void lbind_track(lua_State *L, int idx) {
   lbind_Object *obj = lbO_test(L, idx);
-  if (obj != NULL)
+  if (obj != NULL) {
     obj->o.flags |= LBIND_TRACK;
+    lbG_credit(L, obj, lbind_typeobject(L, idx));
+  }
 }
 
 LB_API void lbind_untrack(lua_State *L, int idx) {
   lbind_Object *obj = lbO_test(L, idx);
-  if (obj != NULL)
+  if (obj != NULL) {
     obj->o.flags &= ~LBIND_TRACK;
+    if ((obj->o.flags & (LBIND_HOLDER|LBIND_VALUE)) == 0)
+      lbG_release(L, obj);
+  }
+}
+
+LB_API void lbind_credit(lua_State *L, int idx) {
+  lbind_Object *obj = lbO_test(L, idx);
+  if (obj != NULL)
+    lbG_credit(L, obj, lbind_typeobject(L, idx));
 }
 
 LB_API int lbind_hastrack(lua_State *L, int idx) {
@@ -1067,6 +2238,326 @@ LB_API int lbind_hastrack(lua_State *L, int idx) {
 }
 
 
+/* lbind cross-state transfer */
+#ifndef LBIND_NO_TRANSFER
+
+#ifdef __GNUC__
+# define lbX_cas(p,o,n) __atomic_compare_exchange_n((p), &(o), (n), 0, \
+                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+# define lbX_xchg(p,n)  __atomic_exchange_n((p), (n), __ATOMIC_ACQUIRE)
+# define lbX_load(p)    __atomic_load_n((p), __ATOMIC_RELAXED)
+#else
+# define lbX_cas(p,o,n) \
+    (_InterlockedCompareExchangePointer((p), (n), (o)) == (o))
+# define lbX_xchg(p,n)  _InterlockedExchangePointer((p), (n))
+# define lbX_load(p)    (*(void *volatile*)(p))
+#endif
+
+typedef struct lbind_Message {
+  struct lbind_Message *next;
+  void *instance;
+  const lbind_Type *type;
+  int flags;
+} lbind_Message;
+
+static void lbX_unintern(lua_State *L, int idx, const void *p) {
+  int top = lua_gettop(L);
+  lbB_internbox(L); /* 1 */
+  if (lua53_rawgetp(L, -1, p) != LUA_TNIL /* 2 */
+      && lua_rawequal(L, -1, lbind_relindex(idx, 2))) {
+    lua_pushnil(L); /* 3 */
+    lua_rawsetp(L, -3, p); /* 3->1 */
+  }
+  lua_settop(L, top);
+}
+
+LB_API int lbind_transfer(lua_State *L, int idx, lbind_Mailbox *mb) {
+  lbind_Message *msg;
+  void *head;
+  lbind_Type *t = lbind_typeobject(L, idx);
+  lbind_Object *obj = lbO_test(L, idx);
+  if (t == NULL || obj == NULL || obj->o.instance == (void*)(obj+1)
+      || (obj->o.flags & (LBIND_HOLDER|LBIND_VALUE)) != 0)
+    return 0;
+  if ((msg = (lbind_Message*)malloc(sizeof(lbind_Message))) == NULL)
+    return 0;
+  msg->instance = obj->o.instance;
+  msg->type = t;
+  msg->flags = obj->o.flags;
+  if ((msg->flags & LBIND_INTERN) != 0)
+    lbX_unintern(L, idx, msg->instance);
+  lbind_delete(L, idx);
+  do
+    msg->next = (lbind_Message*)(head = lbX_load(&mb->head));
+  while (!lbX_cas(&mb->head, head, (void*)msg));
+  return 1;
+}
+
+LB_API int lbind_receive(lua_State *L, lbind_Mailbox *mb) {
+  lbind_Message *msg = (lbind_Message*)mb->pending;
+  lbind_Object *obj;
+  if (msg == NULL) {
+    /* take all posted messages and reverse them into sending order */
+    lbind_Message *posted = (lbind_Message*)lbX_xchg(&mb->head, NULL);
+    while (posted != NULL) {
+      lbind_Message *next = posted->next;
+      posted->next = msg;
+      msg = posted;
+      posted = next;
+    }
+    if (msg == NULL) return 0;
+    mb->pending = msg; /* keep messages if we raise errors below */
+  }
+  if (!lbind_getmetatable(L, msg->type)) /* 1 */
+    return luaL_error(L, "type '%s' is not registered in this state",
+        msg->type->name);
+  obj = lbO_new(L, 0, msg->flags & ~LBIND_SIZED, lbV_count(msg->type)); /* 2 */
+  obj->o.instance = msg->instance;
+  if ((msg->flags & LBIND_INTERN) != 0)
+    lbind_intern(L, msg->instance);
+  lua_insert(L, -2);
+  lua_setmetatable(L, -2); /* (1) */
+  if ((obj->o.flags & LBIND_TRACK) != 0)
+    lbG_credit(L, obj, msg->type);
+  mb->pending = msg->next;
+  free(msg);
+  return 1;
+}
+
+LB_API size_t lbind_freemailbox(lbind_Mailbox *mb, lbind_Discard *discard) {
+  lbind_Message *lists[2], *msg;
+  size_t i, count = 0;
+  lists[0] = (lbind_Message*)mb->pending;
+  lists[1] = (lbind_Message*)lbX_xchg(&mb->head, NULL);
+  mb->pending = NULL;
+  for (i = 0; i < 2; ++i) {
+    while ((msg = lists[i]) != NULL) {
+      lists[i] = msg->next;
+      if (discard != NULL)
+        discard(msg->instance, msg->type);
+      free(msg);
+      ++count;
+    }
+  }
+  return count;
+}
+
+#ifndef LBIND_NO_ASYNC
+#define LBIND_ASYNCBOX 0xA5CB0B07
+
+typedef struct lbind_JobQueue {
+  void *head;         /* completed jobs, newest first */
+  lbind_Job *pending; /* polled jobs, oldest first */
+  lbind_Executor *executor;
+  void *ud;
+} lbind_JobQueue;
+
+union lbind_Job {
+  lbind_MaxAlign dummy; /* ensures maximum alignment for job data */
+  struct {
+    lbind_Job *next;
+    lbind_JobQueue *queue;
+    lbind_Work *work;
+    lbind_Finish *finish;
+    lua_State *L;
+    int ref; /* keeps the waiting coroutine alive */
+  } j;
+};
+
+static lbind_JobQueue *lbY_queue(lua_State *L) {
+  lbind_JobQueue *q;
+  void *key = (void*)(ptrdiff_t)LBIND_ASYNCBOX;
+  if (lua53_rawgetp(L, LUA_REGISTRYINDEX, key) == LUA_TNIL) {
+    lua_pop(L, 1);
+    q = (lbind_JobQueue*)lua_newuserdata(L, sizeof(lbind_JobQueue));
+    memset(q, 0, sizeof(lbind_JobQueue));
+    lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+    return q;
+  }
+  q = (lbind_JobQueue*)lua_touserdata(L, -1);
+  lua_pop(L, 1);
+  return q;
+}
+
+static int lbY_yieldable(lua_State *L) {
+#if LUA_VERSION_NUM >= 503
+  return lua_isyieldable(L);
+#else
+  (void)L; /* can't tell if a C call boundary is in the way */
+  return 0;
+#endif
+}
+
+static int lbY_finish(lua_State *L) {
+  lbind_Job *job = (lbind_Job*)lua_touserdata(L, 1);
+  lua_settop(L, 0);
+  return job->j.finish(L, (void*)(job+1));
+}
+
+static int lbY_pfinish(lua_State *L, lbind_Job *job) {
+  /* run `finish` protected, its results or error are on top */
+  lua_pushcfunction(L, lbY_finish);
+  lua_pushlightuserdata(L, (void*)job);
+  return lua_pcall(L, 1, LUA_MULTRET, 0) == 0;
+}
+
+#if LUA_VERSION_NUM >= 503
+static int lbY_awaitk(lua_State *L, int status, lua_KContext ctx) {
+  /* stack: arguments, results of finish, its status */
+  (void)status;
+  lbB_retrieve(L, LBIND_AWAITBOX);
+  lua_pushthread(L);
+  if (lua53_rawget(L, -2) != LUA_TNIL)
+    return luaL_error(L, "coroutine is awaiting a async call");
+  lua_pop(L, 2);
+  if (!lua_toboolean(L, -1)) {
+    lua_pop(L, 1);
+    return lua_error(L);
+  }
+  lua_pop(L, 1);
+  return lua_gettop(L) - (int)ctx;
+}
+#endif
+
+static int lbY_resume(lua_State *co, lua_State *from, int nargs) {
+  int status;
+#if LUA_VERSION_NUM >= 504
+  int nres;
+  status = lua_resume(co, from, nargs, &nres);
+  if (status == LUA_OK || status == LUA_YIELD)
+    lua_pop(co, nres);
+#else
+# if LUA_VERSION_NUM >= 502
+  status = lua_resume(co, from, nargs);
+# else
+  (void)from;
+  status = lua_resume(co, nargs);
+# endif
+  if (status == 0 || status == LUA_YIELD)
+    lua_settop(co, 0);
+#endif
+  return status;
+}
+
+LB_API void *lbind_newjob(lua_State *L, size_t size, lbind_Work *work, lbind_Finish *finish) {
+  lbind_Job *job = (lbind_Job*)malloc(sizeof(lbind_Job) + size);
+  if (job == NULL) {
+    luaL_error(L, "not enough memory for job");
+    return NULL;
+  }
+  job->j.next = NULL;
+  job->j.queue = NULL;
+  job->j.work = work;
+  job->j.finish = finish;
+  job->j.L = NULL;
+  job->j.ref = LUA_NOREF;
+  return (void*)(job+1);
+}
+
+LB_API int lbind_await(lua_State *L, void *data) {
+  lbind_Job *job = (lbind_Job*)data - 1;
+  lbind_JobQueue *q = lbY_queue(L);
+  int top = lua_gettop(L);
+  if (q->executor == NULL || !lbY_yieldable(L)) {
+    int ok;
+    job->j.work(data);
+    ok = lbY_pfinish(L, job);
+    free(job);
+    if (!ok) return lua_error(L);
+    return lua_gettop(L) - top;
+  }
+  job->j.queue = q;
+  job->j.L = L;
+  lua_pushthread(L);
+  job->j.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  /* mark the coroutine, only lbind_poll may resume it */
+  lbB_retrieve(L, LBIND_AWAITBOX);
+  lua_pushthread(L);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  q->executor(q->ud, job);
+#if LUA_VERSION_NUM >= 503
+  return lua_yieldk(L, 0, (lua_KContext)top, lbY_awaitk);
+#else
+  return lua_yield(L, 0); /* not reached, see lbY_yieldable */
+#endif
+}
+
+LB_API void lbind_runjob(lbind_Job *job) {
+  lbind_JobQueue *q = job->j.queue;
+  void *head;
+  job->j.work((void*)(job+1));
+  do
+    job->j.next = (lbind_Job*)(head = lbX_load(&q->head));
+  while (!lbX_cas(&q->head, head, (void*)job));
+}
+
+LB_API void lbind_setexecutor(lua_State *L, lbind_Executor *e, void *ud) {
+  lbind_JobQueue *q = lbY_queue(L);
+  q->executor = e;
+  q->ud = ud;
+}
+
+LB_API int lbind_poll(lua_State *L) {
+  lbind_JobQueue *q = lbY_queue(L);
+  lbind_Job *done = (lbind_Job*)lbX_xchg(&q->head, NULL), *list = NULL;
+  lbind_Job **tail = &q->pending;
+  int count = 0;
+  /* reverse completed jobs into completion order, after pending ones */
+  while (done != NULL) {
+    lbind_Job *next = done->j.next;
+    done->j.next = list;
+    list = done;
+    done = next;
+  }
+  while (*tail != NULL)
+    tail = &(*tail)->j.next;
+  *tail = list;
+  while (q->pending != NULL) {
+    lbind_Job *job = q->pending;
+    lua_State *co = job->j.L;
+    int top = lua_gettop(L), ok, nres, status;
+    q->pending = job->j.next; /* keep others if we raise errors below */
+    /* anchor the coroutine on our stack before dropping its ref */
+    lua_rawgeti(L, LUA_REGISTRYINDEX, job->j.ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, job->j.ref);
+    lbB_retrieve(L, LBIND_AWAITBOX);
+    lua_pushvalue(L, top+1);
+    lua_pushnil(L);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    ok = lbY_pfinish(L, job);
+    free(job);
+    ++count;
+    if (lua_status(co) != LUA_YIELD) {
+      /* killed by a foreign resume, nobody is waiting */
+      lua_settop(L, top);
+      continue;
+    }
+    lua_pushboolean(L, ok);
+    nres = lua_gettop(L) - (top+1);
+    if (!lua_checkstack(co, nres))
+      luaL_error(L, "too many results to resume");
+    lua_xmove(L, co, nres);
+    status = lbY_resume(co, L, nres);
+    if (status != 0 && status != LUA_YIELD) {
+      lua_xmove(co, L, 1);
+      lua_error(L);
+    }
+    lua_settop(L, top);
+  }
+  return count;
+}
+#endif /* LBIND_NO_ASYNC */
+
+#undef lbX_cas
+#undef lbX_xchg
+#undef lbX_load
+
+#endif /* LBIND_NO_TRANSFER */
+
+
 /* lbind type registry */
 
 LB_API void lbind_inittype(lbind_Type *t, const char *name) {
@@ -1074,6 +2565,16 @@ LB_API void lbind_inittype(lbind_Type *t, const char *name) {
   t->flags = LBIND_DEFAULT_FLAG;
   t->cast = NULL;
   t->bases = NULL;
+  t->size = 0;
+  t->copy = NULL;
+  t->move = NULL;
+  t->destroy = NULL;
+  t->virtuals = NULL;
+  t->director = NULL;
+  t->slots = NULL;
+  t->sizeof_native = NULL;
+  t->serialize = NULL;
+  t->deserialize = NULL;
 }
 
 LB_API void lbind_setbase(lbind_Type *t, lbind_Type **bases, lbind_Cast *cast) {
@@ -1092,6 +2593,15 @@ LB_API int lbind_settrack(lbind_Type *t, int autotrack) {
   return old_flag;
 }
 
+LB_API int lbind_setpod(lbind_Type *t, int pod) {
+  int old_flag = t->flags&LBIND_POD ? 1 : 0;
+  if (pod)
+    t->flags |= LBIND_POD;
+  else
+    t->flags &= ~LBIND_POD;
+  return old_flag;
+}
+
 LB_API int lbind_setintern(lbind_Type *t, int autointern) {
   int old_flag = t->flags&LBIND_INTERN ? 1 : 0;
   if (autointern)
@@ -1101,6 +2611,33 @@ LB_API int lbind_setintern(lbind_Type *t, int autointern) {
   return old_flag;
 }
 
+LB_API void lbind_setvalue(lbind_Type *t, size_t size, lbind_Copy *copy, lbind_Copy *move, lbind_Release *destroy) {
+  t->size = size;
+  t->copy = copy;
+  t->move = move;
+  t->destroy = destroy;
+}
+
+LB_API void lbind_setdirector(lbind_Type *t, const char **virtuals, lbind_GetDirector *director) {
+  t->virtuals = virtuals;
+  t->director = director;
+}
+
+LB_API void lbind_setsizeof(lbind_Type *t, lbind_Sizeof *sizeof_native) {
+  t->sizeof_native = sizeof_native;
+}
+
+LB_API void lbind_setserialize(lbind_Type *t, lbind_Serialize *s, lbind_Deserialize *d) {
+  t->serialize = s;
+  t->deserialize = d;
+}
+
+LB_API void lbind_setslots(lbind_Type *t, const char **slots) {
+  t->slots = slots;
+  if (slots != NULL)
+    t->flags |= LBIND_ACCESSOR;
+}
+
 LB_API lbind_Type *lbind_typeobject(lua_State *L, int idx) {
   lbind_Type *t = NULL;
   if (lua_getmetatable(L, idx)) {
@@ -1126,18 +2663,37 @@ static int lbL_tostring(lua_State *L) {
   return 1;
 }
 
-static int lbL_gc(lua_State *L) {
-  lbind_Object *obj = (lbind_Object*)lua_touserdata(L, 1);
-  if (obj != NULL && check_size(L, 1)) {
-    if ((obj->o.flags & LBIND_TRACK) != 0) {
-      if (lua53_getfield(L, 1, "delete") != LUA_TNIL) {
-        lua_pushvalue(L, 1);
+static void lbO_close(lua_State *L, int idx, int name) {
+  /* `name` is the index of the "delete" string, so the metamethods
+   * keep it in a upvalue instead of hashing it for every object */
+  lbind_Object *obj = (lbind_Object*)lua_touserdata(L, idx);
+  if (obj != NULL && check_size(L, idx)) {
+    if ((obj->o.flags & (LBIND_HOLDER|LBIND_VALUE)) != 0)
+      lbind_delete(L, idx);
+    else if ((obj->o.flags & LBIND_TRACK) != 0) {
+      lua_pushvalue(L, name);
+      if (lua53_gettable(L, idx) != LUA_TNIL) {
+        lua_pushvalue(L, idx);
         lua_call(L, 1, 0);
       }
+      else lua_pop(L, 1);
       if ((obj->o.flags & LBIND_TRACK) != 0)
-        lbind_delete(L, 1);
+        lbind_delete(L, idx);
     }
+    lbG_release(L, obj); /* untracked, or value objects */
   }
+}
+
+LB_API void lbind_close(lua_State *L, int idx) {
+  if (idx < 0 && idx > LUA_REGISTRYINDEX)
+    idx += lua_gettop(L) + 1;
+  lua_pushliteral(L, "delete");
+  lbO_close(L, idx, lua_gettop(L));
+  lua_pop(L, 1);
+}
+
+static int lbL_gc(lua_State *L) {
+  lbO_close(L, 1, lua_upvalueindex(1));
   return 0;
 }
 
@@ -1192,6 +2748,7 @@ static void lbT_setagency(lua_State *L, const char *key) {
 }
 
 LB_API int lbind_newmetatable(lua_State *L, luaL_Reg *libs, const lbind_Type *t) {
+  int i;
   if (lbT_exists(L, t)) return 0;
 
   lua_createtable(L, 0, 8);
@@ -1202,8 +2759,14 @@ LB_API int lbind_newmetatable(lua_State *L, luaL_Reg *libs, const lbind_Type *t)
   lua_pushlightuserdata(L, (void*)t);
   lua_setfield(L, -2, "__type");
 
+  for (i = 0; i < lbV_count(t); ++i) {
+    lua_pushlightuserdata(L, (void*)&lbV_marks[i]);
+    lua_setfield(L, -2, t->slots[i]);
+  }
+
   if (!lbind_hasfield(L, -1, "__gc")) {
-    lua_pushcfunction(L, lbL_gc);
+    lua_pushliteral(L, "delete");
+    lua_pushcclosure(L, lbL_gc, 1);
     lua_setfield(L, -2, "__gc");
   }
 
@@ -1212,6 +2775,14 @@ LB_API int lbind_newmetatable(lua_State *L, luaL_Reg *libs, const lbind_Type *t)
     lua_setfield(L, -2, "__tostring");
   }
 
+#if LUA_VERSION_NUM >= 504
+  if ((t->flags & LBIND_TRACK) != 0 && !lbind_hasfield(L, -1, "__close")) {
+    lua_pushliteral(L, "delete");
+    lua_pushcclosure(L, lbL_gc, 1);
+    lua_setfield(L, -2, "__close");
+  }
+#endif
+
   if ((t->flags & LBIND_ACCESSOR) != 0) {
     int nups = 0;
     int freeslots = 0;
@@ -1227,6 +2798,13 @@ LB_API int lbind_newmetatable(lua_State *L, luaL_Reg *libs, const lbind_Type *t)
       }
     }
     lbind_setaccessors(L, nups, LBIND_INDEX|LBIND_NEWINDEX);
+    /* only director types look for overrides on __newindex */
+    if (t->virtuals != NULL && t->director != NULL) {
+      lua_getfield(L, -1, "__newindex");
+      lua_pushlightuserdata(L, (void*)t);
+      lua_setupvalue(L, -2, 3);
+      lua_pop(L, 1);
+    }
   }
 
   else if (!lbind_hasfield(L, -1, "__index")) {
@@ -1282,10 +2860,10 @@ LB_API const char *lbind_tolstring(lua_State *L, int idx, size_t *plen) {
   if (obj != NULL && tname)
     lua_pushfstring(L, "%s: %p", tname, obj->o.instance);
   else if (obj == NULL) {
-    lbind_Object *obj = (lbind_Object*)lbind_touserdata(L, idx);
+    lbind_Object *obj = lbO_touserdata(L, idx);
     if (obj == NULL)
       return luaL_tolstring(L, idx, plen);
-    if (tname && check_size(L, idx))
+    if (tname)
       lua_pushfstring(L, "%s[N]: %p", tname, obj->o.instance);
     else
       lua_pushfstring(L, "userdata: %p", (void*)obj);
@@ -1304,13 +2882,50 @@ LB_API int lbind_isa(lua_State *L, int idx, const lbind_Type *t) {
 }
 
 LB_API void *lbind_cast(lua_State *L, int idx, const lbind_Type *t) {
-  lbind_Object *obj = (lbind_Object*)lbind_touserdata(L, idx);
-  if (!check_size(L, idx) || obj == NULL || obj->o.instance == NULL)
-    return NULL;
-  return lbT_testmeta(L, idx, t) ? obj->o.instance : lbT_trycast(L, idx, t);
+  int top = lua_gettop(L);
+  lbind_Object *obj = (lbind_Object*)lbP_touserdata(L, &idx,
+      (t->flags & LBIND_NOPEER) == 0);
+  void *u = NULL;
+  if (check_size(L, idx) && obj != NULL && obj->o.instance != NULL)
+    u = lbT_testmeta(L, idx, t) ? obj->o.instance : lbT_trycast(L, idx, t);
+  lua_settop(L, top);
+  return u;
+}
+
+static void lbT_construct(lua_State *L, void *src, const lbind_Type *t, lbind_Copy *ctor) {
+  /* value objects are owned by Lua, but never call `delete` */
+  int flags = t->flags & ~(LBIND_TRACK|LBIND_INTERN);
+  lbind_Object *obj;
+  if (t->destroy == NULL)
+    obj = lbO_new(L, t->size, flags, lbV_count(t));
+  else {
+    obj = lbO_new(L, sizeof(lbind_Holder) + t->size, flags, lbV_count(t));
+    obj->o.instance = (void*)(lbO_holder(obj)+1);
+  }
+  if ((t->flags & LBIND_INTERN) != 0) {
+    lbind_intern(L, obj->o.instance);
+    obj->o.flags |= LBIND_INTERN;
+  }
+  lbind_setmetatable(L, t);
+  ctor(obj->o.instance, src);
+  if (t->destroy != NULL)
+    lbO_holder(obj)->release = t->destroy;
+  obj->o.flags |= LBIND_VALUE;
+  lbG_credit(L, obj, t);
+}
+
+LB_API int lbind_move(lua_State *L, void *obj, const lbind_Type *t) {
+  if (t->move == NULL || t->size == 0)
+    return lbind_copy(L, obj, t);
+  lbT_construct(L, obj, t, t->move);
+  return 1;
 }
 
 LB_API int lbind_copy(lua_State *L, const void *obj, const lbind_Type *t) {
+  if (t->copy != NULL && t->size != 0) {
+    lbT_construct(L, (void*)obj, t, t->copy);
+    return 1;
+  }
   if (!lbind_getmetatable(L, t)) /* 1 */
     return 0;
   lua_pushliteral(L, "new"); /* 2 */
@@ -1329,25 +2944,911 @@ LB_API int lbind_copy(lua_State *L, const void *obj, const lbind_Type *t) {
   return 1;
 }
 
-LB_API void *lbind_check(lua_State *L, int idx, const lbind_Type *t) {
-  lbind_Object *obj = (lbind_Object*)lbind_touserdata(L, idx);
+LB_API void *lbind_check(lua_State *L, int narg, const lbind_Type *t) {
+  int idx = narg, top = lua_gettop(L);
+  lbind_Object *obj = (lbind_Object*)lbP_touserdata(L, &idx,
+      (t->flags & LBIND_NOPEER) == 0);
   void *u = NULL;
   if (!check_size(L, idx))
-    luaL_argerror(L, idx, "invalid lbind userdata");
+    lbR_error(L, narg, "invalid lbind userdata");
   if (obj == NULL || obj->o.instance == NULL) {
-    luaL_argerror(L, idx, "null lbind object");
+    lbR_error(L, narg, "null lbind object");
     return NULL;
   }
   u = lbT_testmeta(L, idx, t) ? obj->o.instance : lbT_trycast(L, idx, t);
-  if (u == NULL) lbind_typeerror(L, idx, t->name);
+  lua_settop(L, top);
+  if (u == NULL) lbind_typeerror(L, narg, t->name);
   return u;
 }
 
 LB_API void *lbind_test(lua_State *L, int idx, const lbind_Type *t) {
-  lbind_Object *obj = (lbind_Object*)lbind_touserdata(L, idx);
-  return lbT_testmeta(L, idx, t) ? obj->o.instance : lbT_trycast(L, idx, t);
+  int top = lua_gettop(L);
+  lbind_Object *obj = (lbind_Object*)lbP_touserdata(L, &idx,
+      (t->flags & LBIND_NOPEER) == 0);
+  void *u = lbT_testmeta(L, idx, t) ? obj->o.instance : lbT_trycast(L, idx, t);
+  lua_settop(L, top);
+  return u;
+}
+
+
+/* lbind callback support */
+
+#define LBIND_CBGUARDBOX 0xCB6A7B07
+
+typedef struct lbQ_Guard {
+  lbind_CallbackPool *pool;
+  int i;
+  unsigned guard;
+} lbQ_Guard;
+
+static int lbQ_hash(const lbind_CallbackPool *pool, lbind_Thunk f) {
+  size_t h = (size_t)f;
+  return (int)((h ^ (h >> 4)) % (size_t)pool->size);
+}
+
+static void lbQ_hashthunks(lbind_CallbackPool *pool) {
+  /* chain thunks by their hash, so a thunk finds its slot directly */
+  int i, h;
+  for (i = 0; i < pool->size; ++i)
+    pool->slots[i].hash = -1;
+  for (i = 0; i < pool->size; ++i) {
+    h = lbQ_hash(pool, pool->thunks[i]);
+    pool->slots[i].chain = pool->slots[h].hash;
+    pool->slots[h].hash = i;
+  }
+  pool->hashed = 1;
+}
+
+static int lbQ_index(const lbind_CallbackPool *pool, lbind_Thunk f) {
+  int i = -1;
+  if (pool->hashed && f != NULL) {
+    i = pool->slots[lbQ_hash(pool, f)].hash;
+    while (i >= 0 && pool->thunks[i] != f)
+      i = pool->slots[i].chain;
+  }
+  return i >= 0 && pool->slots[i].L != NULL ? i : -1;
+}
+
+static void lbQ_release(lbind_CallbackPool *pool, int i) {
+  lbind_Callback *slot = &pool->slots[i];
+  luaL_unref(slot->L, LUA_REGISTRYINDEX, slot->ref);
+  slot->L = NULL;
+  slot->ref = LUA_NOREF;
+  ++slot->guard;
+  slot->next = pool->freelist;
+  pool->freelist = i;
+  if (--pool->live == 0)
+    pool->owner = NULL;
+}
+
+static int lbL_callbackgc(lua_State *L) {
+  lbQ_Guard *g = (lbQ_Guard*)lua_touserdata(L, 1);
+  if (g->i >= 0 && g->pool->slots[g->i].L != NULL
+      && g->pool->slots[g->i].guard == g->guard)
+    lbQ_release(g->pool, g->i);
+  return 0;
+}
+
+LB_API lbind_Thunk lbind_bindcallback(lua_State *L, int idx, lbind_CallbackPool *pool) {
+  lua_State *L1;
+  int i, ref;
+  if (!lua_isfunction(L, idx))
+    return NULL;
+  L1 = lbind_mainthread(L);
+  if ((pool->owner != NULL && pool->owner != L1)
+      || (pool->freelist < 0 && pool->used >= pool->size))
+    return NULL;
+  if (!pool->hashed)
+    lbQ_hashthunks(pool);
+  lua_pushvalue(L, idx);
+  ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  if ((i = pool->freelist) >= 0)
+    pool->freelist = pool->slots[i].next;
+  else
+    i = pool->used++;
+  pool->slots[i].ref = ref;
+  pool->slots[i].L = L1;
+  pool->slots[i].next = -1;
+  pool->owner = L1;
+  ++pool->live;
+  return pool->thunks[i];
+}
+
+LB_API lbind_Thunk lbind_checkcallback(lua_State *L, int idx, lbind_CallbackPool *pool) {
+  lbQ_Guard *g;
+  lbind_Thunk f;
+  if (!lua_isfunction(L, idx))
+    lbind_typeerror(L, idx, "function");
+  if (pool->owner != NULL && pool->owner != lbind_mainthread(L))
+    lbind_argferror(L, idx, "callbacks of %s are used by another state",
+        pool->name);
+  luaL_checkstack(L, 2, "no space for callback guard");
+  g = (lbQ_Guard*)lua_newuserdata(L, sizeof(lbQ_Guard));
+  g->pool = pool;
+  g->i = -1;
+  if (lbB_retrieve(L, LBIND_CBGUARDBOX)) {
+    lua_pushcfunction(L, lbL_callbackgc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  idx = lbind_relindex(idx, 1);
+  if ((f = lbind_bindcallback(L, idx, pool)) == NULL) {
+    /* guards of failed calls may hold the rest */
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    if ((f = lbind_bindcallback(L, idx, pool)) == NULL)
+      lbind_argferror(L, idx, "too many callbacks (%d) of %s",
+          pool->size, pool->name);
+  }
+  g->i = lbQ_index(pool, f);
+  g->guard = pool->slots[g->i].guard;
+  return f;
+}
+
+LB_API int lbind_releasecallback(lbind_CallbackPool *pool, lbind_Thunk f) {
+  int i = lbQ_index(pool, f);
+  if (i < 0) return 0;
+  lbQ_release(pool, i);
+  return 1;
+}
+
+LB_API int lbind_keepcallback(lbind_CallbackPool *pool, lbind_Thunk f) {
+  int i = lbQ_index(pool, f);
+  if (i < 0) return 0;
+  ++pool->slots[i].guard;
+  return 1;
+}
+
+LB_API lua_State *lbind_pushcallback(lbind_CallbackPool *pool, int i, int nstack) {
+  lua_State *L = pool->slots[i].L;
+  /* the function, its arguments and the message handler */
+  if (L == NULL || !lua_checkstack(L, nstack + 2)) {
+    fprintf(stderr, "lbind: callback of %s: %s\n", pool->name,
+        L == NULL ? "called after released" : "stack overflow");
+    return NULL;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, pool->slots[i].ref);
+  return L;
+}
+
+LB_API int lbind_callcallback(lua_State *L, lbind_CallbackPool *pool, int nargs, int nrets) {
+  /* the main thread may be running or normal here, errors can't
+   * unwind into the C code calling the thunk */
+  const char *msg;
+  if (lbind_pcall(L, nargs, nrets) == 0)
+    return 1;
+  msg = lua_tostring(L, -1);
+  fprintf(stderr, "lbind: callback of %s: %s\n", pool->name,
+      msg != NULL ? msg : "(error object is not a string)");
+  lua_pop(L, 1);
+  return 0;
+}
+
+
+/* lbind buffer support */
+#ifndef LBIND_NO_BUFFER
+
+static lbind_Type lbU_buffertype = { "lbind.buffer", 0, NULL, NULL,
+                                     0, NULL, NULL, NULL, NULL, NULL, NULL,
+                                     NULL, NULL, NULL };
+
+static size_t lbU_posrelat(lua_Integer pos, size_t len) {
+  if (pos >= 0) return (size_t)pos;
+  else if ((size_t)-pos > len) return 0;
+  return len + (size_t)pos + 1;
+}
+
+static void lbU_range(lua_State *L, lbind_Buffer *b, size_t *pi, size_t *pj) {
+  size_t i = lbU_posrelat(luaL_optinteger(L, 2, 1), b->size);
+  size_t j = lbU_posrelat(luaL_optinteger(L, 3, -1), b->size);
+  if (i < 1) i = 1;
+  if (j > b->size) j = b->size;
+  *pi = i - 1;
+  *pj = i <= j ? j : i - 1;
+}
+
+static int lbL_bufsize(lua_State *L) {
+  lbind_Buffer *b = lbind_checkbuffer(L, 1);
+  if (!lua_isnoneornil(L, 2)) {
+    lua_Integer size = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, size >= 0 && (size_t)size <= b->capacity, 2,
+        "size out of capacity");
+    b->size = (size_t)size;
+  }
+  lua_pushinteger(L, (lua_Integer)b->size);
+  return 1;
+}
+
+static int lbL_bufcapacity(lua_State *L) {
+  lbind_Buffer *b = lbind_checkbuffer(L, 1);
+  lua_pushinteger(L, (lua_Integer)b->capacity);
+  return 1;
+}
+
+static int lbL_bufsub(lua_State *L) {
+  size_t i, j;
+  lbU_range(L, lbind_checkbuffer(L, 1), &i, &j);
+  lbind_slicebuffer(L, 1, i, j);
+  return 1;
+}
+
+static int lbL_buftostring(lua_State *L) {
+  lbind_Buffer *b = lbind_checkbuffer(L, 1);
+  size_t i, j;
+  lbU_range(L, b, &i, &j);
+  lua_pushlstring(L, b->data + i, j - i);
+  return 1;
+}
+
+static int lbL_bufwrite(lua_State *L) {
+  lbind_Buffer *b = lbind_checkbuffer(L, 1);
+  size_t len, offset = (size_t)luaL_optinteger(L, 3, b->size + 1) - 1;
+  const char *s = luaL_checklstring(L, 2, &len);
+  luaL_argcheck(L, offset <= b->size, 3, "offset out of range");
+  if (len > b->capacity - offset)
+    len = b->capacity - offset;
+  memcpy(b->data + offset, s, len);
+  if (offset + len > b->size)
+    b->size = offset + len;
+  lua_pushinteger(L, (lua_Integer)len);
+  return 1;
+}
+
+static int lbL_buflen(lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)lbind_checkbuffer(L, 1)->size);
+  return 1;
+}
+
+static void lbU_setmetatable(lua_State *L) {
+  luaL_Reg libs[] = {
+    { "__len",    lbL_buflen      },
+    { "capacity", lbL_bufcapacity },
+    { "size",     lbL_bufsize     },
+    { "sub",      lbL_bufsub      },
+    { "tostring", lbL_buftostring },
+    { "write",    lbL_bufwrite    },
+    { NULL, NULL }
+  };
+  if (!lbind_getmetatable(L, &lbU_buffertype)
+      && !lbind_newmetatable(L, libs, &lbU_buffertype))
+    luaL_getmetatable(L, lbU_buffertype.name);
+  lua_setmetatable(L, -2);
+}
+
+LB_API lbind_Buffer *lbind_newbuffer(lua_State *L, size_t capacity) {
+  lbind_Buffer *b = (lbind_Buffer*)lbind_raw(L,
+      sizeof(lbind_Buffer) + capacity, 0);
+  b->data = (char*)(b+1);
+  b->size = 0;
+  b->capacity = capacity;
+  lbU_setmetatable(L);
+  return b;
 }
 
+LB_API lbind_Buffer *lbind_slicebuffer(lua_State *L, int idx, size_t begin, size_t end) {
+  lbind_Buffer *b = lbind_checkbuffer(L, idx), *slice;
+  if (end > b->size) end = b->size;
+  if (begin > end) begin = end;
+  slice = (lbind_Buffer*)lbind_raw(L, sizeof(lbind_Buffer), 0);
+  slice->data = b->data + begin;
+  slice->size = slice->capacity = end - begin;
+  lbU_setmetatable(L);
+  /* keep the storage alive */
+#if LUA_VERSION_NUM >= 503
+  lua_pushvalue(L, lbind_relindex(idx, 1));
+#else
+  lua_createtable(L, 1, 0);
+  lua_pushvalue(L, lbind_relindex(idx, 2));
+  lua_rawseti(L, -2, 1);
+#endif
+  lua_setuservalue(L, -2);
+  return slice;
+}
+
+LB_API lbind_Buffer *lbind_testbuffer(lua_State *L, int idx) {
+  return (lbind_Buffer*)lbind_test(L, idx, &lbU_buffertype);
+}
+
+LB_API lbind_Buffer *lbind_checkbuffer(lua_State *L, int idx) {
+  return (lbind_Buffer*)lbind_check(L, idx, &lbU_buffertype);
+}
+
+#endif /* LBIND_NO_BUFFER */
+
+
+/* lbind struct marshaling */
+#ifndef LBIND_NO_STRUCT
+
+LB_API void lbind_pushfield(lua_State *L, const void *p, const lbind_Field *f) {
+  const char *field = (const char*)p + f->offset;
+  switch (f->kind & LBIND_FKIND) {
+  case LBIND_FINT:
+    switch (f->size) {
+    case 1: lua_pushinteger(L, *(const signed char*)field); return;
+    case 2: lua_pushinteger(L, *(const short*)field); return;
+    case 4: lua_pushinteger(L, (lua_Integer)*(const int*)field); return;
+    default: lua_pushinteger(L, (lua_Integer)*(const long long*)field); return;
+    }
+  case LBIND_FUINT:
+    switch (f->size) {
+    case 1: lua_pushinteger(L, *(const unsigned char*)field); return;
+    case 2: lua_pushinteger(L, *(const unsigned short*)field); return;
+    case 4: lua_pushinteger(L, (lua_Integer)*(const unsigned*)field); return;
+    default: lua_pushinteger(L, (lua_Integer)*(const unsigned long long*)field); return;
+    }
+  case LBIND_FNUMBER:
+    if (f->size == sizeof(float))
+      lua_pushnumber(L, (lua_Number)*(const float*)field);
+    else
+      lua_pushnumber(L, (lua_Number)*(const double*)field);
+    return;
+  case LBIND_FBOOL:
+    lua_pushboolean(L, f->size == 1 ? *(const char*)field != 0
+                                    : *(const int*)field != 0);
+    return;
+  case LBIND_FSTRING:
+    lua_pushstring(L, *(const char* const*)field);
+    return;
+  }
+  lua_pushnil(L);
+}
+
+LB_API void lbind_tofield(lua_State *L, int idx, void *p, const lbind_Field *f) {
+  char *field = (char*)p + f->offset;
+  switch (f->kind & LBIND_FKIND) {
+  case LBIND_FINT: case LBIND_FUINT: {
+    lua_Integer v = lua_tointeger(L, idx);
+    switch (f->size) {
+    case 1: *(char*)field = (char)v; break;
+    case 2: *(short*)field = (short)v; break;
+    case 4: *(int*)field = (int)v; break;
+    default: *(long long*)field = (long long)v; break;
+    }
+    break;
+  }
+  case LBIND_FNUMBER:
+    if (f->size == sizeof(float))
+      *(float*)field = (float)lua_tonumber(L, idx);
+    else
+      *(double*)field = (double)lua_tonumber(L, idx);
+    break;
+  case LBIND_FBOOL:
+    if (f->size == 1) *field = (char)lua_toboolean(L, idx);
+    else *(int*)field = lua_toboolean(L, idx);
+    break;
+  case LBIND_FSTRING:
+    if (lua_type(L, idx) != LUA_TSTRING && !lua_isnil(L, idx))
+      luaL_error(L, "string expected for field '%s', got %s",
+          f->name, luaL_typename(L, idx));
+    *(const char**)field = lua_tostring(L, idx);
+    break;
+  }
+}
+
+static int lbS_pushkeys(lua_State *L, const lbind_Field *fields) {
+  /* field names are pushed once and reused for every element */
+  int nfields = 0;
+  for (; fields[nfields].name != NULL; ++nfields)
+    ;
+  luaL_checkstack(L, nfields + 3, "too many fields");
+  for (nfields = 0; fields[nfields].name != NULL; ++nfields)
+    lua_pushstring(L, fields[nfields].name);
+  return nfields;
+}
+
+LB_API void lbind_pushstructs(lua_State *L, const void *a, size_t n, size_t stride, const lbind_Field *fields) {
+  const char *p = (const char*)a;
+  int i, nfields, keys;
+  size_t j;
+  lua_createtable(L, (int)n, 0);
+  keys = lua_gettop(L) + 1;
+  nfields = lbS_pushkeys(L, fields);
+  for (j = 0; j < n; ++j, p += stride) {
+    lua_createtable(L, 0, nfields);
+    for (i = 0; i < nfields; ++i) {
+      lua_pushvalue(L, keys + i);
+      lbind_pushfield(L, p, &fields[i]);
+      lua_rawset(L, -3);
+    }
+    lua_rawseti(L, keys - 1, (lua_Integer)j + 1);
+  }
+  lua_settop(L, keys - 1);
+}
+
+LB_API size_t lbind_tostructs(lua_State *L, int idx, void *a, size_t n, size_t stride, const lbind_Field *fields) {
+  char *p = (char*)a;
+  int i, nfields, keys;
+  size_t j, len;
+  if (idx < 0 && idx > LUA_REGISTRYINDEX)
+    idx += lua_gettop(L) + 1;
+  len = lua_rawlen(L, idx);
+  if (n > len) n = len;
+  keys = lua_gettop(L) + 1;
+  nfields = lbS_pushkeys(L, fields);
+  for (j = 0; j < n; ++j, p += stride) {
+    lua_rawgeti(L, idx, (lua_Integer)j + 1);
+    if (!lua_istable(L, -1)) break;
+    for (i = 0; i < nfields; ++i) {
+      lua_pushvalue(L, keys + i);
+      lua_rawget(L, -2);
+      lbind_tofield(L, -1, p, &fields[i]);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+  lua_settop(L, keys - 1);
+  return j;
+}
+
+LB_API void lbind_pushcolumns(lua_State *L, const void *a, size_t n, size_t stride, const lbind_Field *fields) {
+  lua_createtable(L, 0, 0);
+  luaL_checkstack(L, 3, "no space for columns");
+  for (; fields->name != NULL; ++fields) {
+    const char *p = (const char*)a;
+    size_t j;
+    lua_createtable(L, (int)n, 0);
+    for (j = 0; j < n; ++j, p += stride) {
+      lbind_pushfield(L, p, fields);
+      lua_rawseti(L, -2, (lua_Integer)j + 1);
+    }
+    lua_setfield(L, -2, fields->name);
+  }
+}
+
+LB_API size_t lbind_tocolumns(lua_State *L, int idx, void *a, size_t n, size_t stride, const lbind_Field *fields) {
+  const lbind_Field *f;
+  size_t j, len;
+  if (idx < 0 && idx > LUA_REGISTRYINDEX)
+    idx += lua_gettop(L) + 1;
+  luaL_checkstack(L, 3, "no space for columns");
+  /* shortest column first, so all columns write the same elements */
+  for (f = fields; f->name != NULL && n > 0; ++f) {
+    lua_getfield(L, idx, f->name);
+    len = lua_istable(L, -1) ? lua_rawlen(L, -1) : 0;
+    if (n > len) n = len;
+    lua_pop(L, 1);
+  }
+  for (; n > 0 && fields->name != NULL; ++fields) {
+    char *p = (char*)a;
+    lua_getfield(L, idx, fields->name);
+    for (j = 0; j < n; ++j, p += stride) {
+      lua_rawgeti(L, -1, (lua_Integer)j + 1);
+      lbind_tofield(L, -1, p, fields);
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+  return n;
+}
+
+#endif /* LBIND_NO_STRUCT */
+
+
+/* lbind numeric array support */
+#ifndef LBIND_NO_ARRAY
+
+#if !defined(LBIND_NO_SIMD) && (defined(__GNUC__) || defined(_MSC_VER)) \
+    && (defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__))
+# define LBIND_USE_SSE2
+# include <emmintrin.h>
+# if defined(__GNUC__) && (__GNUC__ > 4 || defined(__clang__))
+#   define LBIND_USE_AVX2
+#   include <immintrin.h>
+# endif
+#endif
+
+#define LBA_ADD 0
+#define LBA_SUB 1
+#define LBA_MUL 2
+#define LBA_DIV 3
+
+typedef struct lbA_Kernels {
+  double (*sum)    (const void *a, size_t n);
+  double (*dot)    (const void *a, const void *b, size_t n);
+  void   (*minmax) (const void *a, size_t n, double *pmin, double *pmax);
+  void   (*arith)  (void *a, const void *b, size_t n, int op);
+  void   (*arithk) (void *a, size_t n, double k, int op);
+  void   (*clamp)  (void *a, size_t n, double lo, double hi);
+} lbA_Kernels;
+
+#define lbA_load(p)     (*(p))
+#define lbA_store(p,v)  (*(p) = (v))
+#define lbA_add(a,b)    ((a) + (b))
+#define lbA_sub(a,b)    ((a) - (b))
+#define lbA_mul(a,b)    ((a) * (b))
+#define lbA_div(a,b)    ((a) / (b))
+#define lbA_min(a,b)    ((b) < (a) ? (b) : (a))
+#define lbA_max(a,b)    ((b) > (a) ? (b) : (a))
+
+#define LBA_LOOP(W, LOAD, STORE, VOP, SOP, B, SB) do {                 \
+    for (; i + W <= n; i += W)                                          \
+      STORE(a+i, VOP(LOAD(a+i), B));                                    \
+    for (; i < n; ++i)                                                  \
+      a[i] = SOP(a[i], SB);                                             \
+  } while (0)
+
+/* generate the reductions of element type T, they accumulate in double
+ * vector DV of DW lanes, LOAD widens DW elements of T into it */
+#define LBA_REDUCE(P, T, DV, DW, ATTR, LOAD, STORE, SET1, ADD, MUL)     \
+static ATTR double P##_sum(const void *pa, size_t n) {                  \
+  const T *a = (const T*)pa;                                            \
+  double tmp[DW], r = 0;                                                \
+  DV acc = SET1(0);                                                     \
+  size_t i, j;                                                          \
+  for (i = 0; i + DW <= n; i += DW)                                     \
+    acc = ADD(acc, LOAD(a+i));                                          \
+  STORE(tmp, acc);                                                      \
+  for (j = 0; j < DW; ++j) r += tmp[j];                                 \
+  for (; i < n; ++i) r += a[i];                                         \
+  return r;                                                             \
+}                                                                       \
+static ATTR double P##_dot(const void *pa, const void *pb, size_t n) {  \
+  const T *a = (const T*)pa, *b = (const T*)pb;                         \
+  double tmp[DW], r = 0;                                                \
+  DV acc = SET1(0);                                                     \
+  size_t i, j;                                                          \
+  for (i = 0; i + DW <= n; i += DW)                                     \
+    acc = ADD(acc, MUL(LOAD(a+i), LOAD(b+i)));                          \
+  STORE(tmp, acc);                                                      \
+  for (j = 0; j < DW; ++j) r += tmp[j];                                 \
+  for (; i < n; ++i) r += (double)a[i]*b[i];                            \
+  return r;                                                             \
+}
+
+/* generate a kernel set of element type T on vector type V of W lanes,
+ * the scalar set uses V == T and W == 1. the reductions of P must be
+ * generated first, by LBA_REDUCE */
+#define LBA_KERNELS(P, T, V, W, ATTR, LOAD, STORE, SET1,                 \
+                    ADD, SUB, MUL, DIV, MIN, MAX)                       \
+static ATTR void P##_minmax(const void *pa, size_t n,                   \
+                            double *pmin, double *pmax) {               \
+  const T *a = (const T*)pa;                                            \
+  T tmin[W], tmax[W], mn = a[0], mx = a[0];                             \
+  size_t i = 0, j;                                                      \
+  if (n >= W) {                                                         \
+    V vmin = LOAD(a), vmax = vmin;                                      \
+    for (i = W; i + W <= n; i += W) {                                   \
+      V v = LOAD(a+i);                                                  \
+      vmin = MIN(vmin, v);                                              \
+      vmax = MAX(vmax, v);                                              \
+    }                                                                   \
+    STORE(tmin, vmin);                                                  \
+    STORE(tmax, vmax);                                                  \
+    for (j = 0; j < W; ++j) {                                           \
+      mn = lbA_min(mn, tmin[j]);                                        \
+      mx = lbA_max(mx, tmax[j]);                                        \
+    }                                                                   \
+  }                                                                     \
+  for (; i < n; ++i) {                                                  \
+    mn = lbA_min(mn, a[i]);                                             \
+    mx = lbA_max(mx, a[i]);                                             \
+  }                                                                     \
+  *pmin = mn, *pmax = mx;                                               \
+}                                                                       \
+static ATTR void P##_arith(void *pa, const void *pb, size_t n, int op) {\
+  T *a = (T*)pa;                                                        \
+  const T *b = (const T*)pb;                                            \
+  size_t i = 0;                                                         \
+  switch (op) {                                                         \
+  case LBA_ADD:                                                         \
+    LBA_LOOP(W, LOAD, STORE, ADD,                                       \
+             lbA_add, LOAD(b+i), b[i]);                                 \
+    break;                                                              \
+  case LBA_SUB:                                                         \
+    LBA_LOOP(W, LOAD, STORE, SUB,                                       \
+             lbA_sub, LOAD(b+i), b[i]);                                 \
+    break;                                                              \
+  case LBA_MUL:                                                         \
+    LBA_LOOP(W, LOAD, STORE, MUL,                                       \
+             lbA_mul, LOAD(b+i), b[i]);                                 \
+    break;                                                              \
+  case LBA_DIV:                                                         \
+    LBA_LOOP(W, LOAD, STORE, DIV,                                       \
+             lbA_div, LOAD(b+i), b[i]);                                 \
+    break;                                                              \
+  }                                                                     \
+}                                                                       \
+static ATTR void P##_arithk(void *pa, size_t n, double k, int op) {     \
+  T *a = (T*)pa, sk = (T)k;                                             \
+  V vk = SET1(sk);                                                      \
+  size_t i = 0;                                                         \
+  switch (op) {                                                         \
+  case LBA_ADD:                                                         \
+    LBA_LOOP(W, LOAD, STORE, ADD,                                       \
+             lbA_add, vk, sk);                                          \
+    break;                                                              \
+  case LBA_SUB:                                                         \
+    LBA_LOOP(W, LOAD, STORE, SUB,                                       \
+             lbA_sub, vk, sk);                                          \
+    break;                                                              \
+  case LBA_MUL:                                                         \
+    LBA_LOOP(W, LOAD, STORE, MUL,                                       \
+             lbA_mul, vk, sk);                                          \
+    break;                                                              \
+  case LBA_DIV:                                                         \
+    LBA_LOOP(W, LOAD, STORE, DIV,                                       \
+             lbA_div, vk, sk);                                          \
+    break;                                                              \
+  }                                                                     \
+}                                                                       \
+static ATTR void P##_clamp(void *pa, size_t n, double lo, double hi) {  \
+  T *a = (T*)pa, slo = (T)lo, shi = (T)hi;                              \
+  V vlo = SET1(slo), vhi = SET1(shi);                                   \
+  size_t i = 0;                                                         \
+  for (; i + W <= n; i += W)                                            \
+    STORE(a+i, MIN(MAX(LOAD(a+i), vlo), vhi));                          \
+  for (; i < n; ++i)                                                    \
+    a[i] = lbA_min(lbA_max(a[i], slo), shi);                            \
+}                                                                       \
+static const lbA_Kernels P = {                                          \
+  P##_sum, P##_dot, P##_minmax, P##_arith, P##_arithk, P##_clamp        \
+};
+
+#define lbA_fset1(x) ((float)(x))
+#define lbA_dset1(x) ((double)(x))
+#define lbA_loadd(p) ((double)*(p))
+
+LBA_REDUCE(lbA_scalarf, float, double, 1, , lbA_loadd, lbA_store,
+    lbA_dset1, lbA_add, lbA_mul)
+LBA_REDUCE(lbA_scalard, double, double, 1, , lbA_loadd, lbA_store,
+    lbA_dset1, lbA_add, lbA_mul)
+LBA_KERNELS(lbA_scalarf, float, float, 1, , lbA_load, lbA_store,
+    lbA_fset1, lbA_add, lbA_sub, lbA_mul, lbA_div, lbA_min, lbA_max)
+LBA_KERNELS(lbA_scalard, double, double, 1, , lbA_load, lbA_store,
+    lbA_dset1, lbA_add, lbA_sub, lbA_mul, lbA_div, lbA_min, lbA_max)
+
+#ifdef LBIND_USE_SSE2
+# define lbA_sse2_loadfd(p) \
+    _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(p))))
+LBA_REDUCE(lbA_sse2f, float, __m128d, 2, , lbA_sse2_loadfd, _mm_storeu_pd,
+    _mm_set1_pd, _mm_add_pd, _mm_mul_pd)
+LBA_REDUCE(lbA_sse2d, double, __m128d, 2, , _mm_loadu_pd, _mm_storeu_pd,
+    _mm_set1_pd, _mm_add_pd, _mm_mul_pd)
+LBA_KERNELS(lbA_sse2f, float, __m128, 4, , _mm_loadu_ps, _mm_storeu_ps,
+    _mm_set1_ps, _mm_add_ps, _mm_sub_ps, _mm_mul_ps, _mm_div_ps,
+    _mm_min_ps, _mm_max_ps)
+LBA_KERNELS(lbA_sse2d, double, __m128d, 2, , _mm_loadu_pd, _mm_storeu_pd,
+    _mm_set1_pd, _mm_add_pd, _mm_sub_pd, _mm_mul_pd, _mm_div_pd,
+    _mm_min_pd, _mm_max_pd)
+#endif /* LBIND_USE_SSE2 */
+
+#ifdef LBIND_USE_AVX2
+# define LBA_AVX2 __attribute__((target("avx2")))
+# define lbA_avx2_loadfd(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+LBA_REDUCE(lbA_avx2f, float, __m256d, 4, LBA_AVX2, lbA_avx2_loadfd,
+    _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_mul_pd)
+LBA_REDUCE(lbA_avx2d, double, __m256d, 4, LBA_AVX2, _mm256_loadu_pd,
+    _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_mul_pd)
+LBA_KERNELS(lbA_avx2f, float, __m256, 8, LBA_AVX2, _mm256_loadu_ps,
+    _mm256_storeu_ps, _mm256_set1_ps, _mm256_add_ps, _mm256_sub_ps,
+    _mm256_mul_ps, _mm256_div_ps, _mm256_min_ps, _mm256_max_ps)
+LBA_KERNELS(lbA_avx2d, double, __m256d, 4, LBA_AVX2, _mm256_loadu_pd,
+    _mm256_storeu_pd, _mm256_set1_pd, _mm256_add_pd, _mm256_sub_pd,
+    _mm256_mul_pd, _mm256_div_pd, _mm256_min_pd, _mm256_max_pd)
+#endif /* LBIND_USE_AVX2 */
+
+static const lbA_Kernels *lbA_kernels(int type) {
+  /* pick the widest kernel set the cpu supports. no cache here, states
+   * on other threads may call it at the same time; the cpu features
+   * are detected by libgcc before main(), so the check is only a load */
+#ifdef LBIND_USE_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return type == LBIND_AFLOAT ? &lbA_avx2f : &lbA_avx2d;
+#endif
+#ifdef LBIND_USE_SSE2
+  return type == LBIND_AFLOAT ? &lbA_sse2f : &lbA_sse2d;
+#else
+  return type == LBIND_AFLOAT ? &lbA_scalarf : &lbA_scalard;
+#endif
+}
+
+static lbind_Type lbA_arraytype = { "lbind.array", 0, NULL, NULL,
+                                    0, NULL, NULL, NULL, NULL, NULL, NULL,
+                                    NULL, NULL, NULL };
+
+static double lbA_get(const lbind_Array *a, size_t i) {
+  return a->type == LBIND_AFLOAT ? (double)((float*)a->data)[i]
+                                 : ((double*)a->data)[i];
+}
+
+static void lbA_set(lbind_Array *a, size_t i, double v) {
+  if (a->type == LBIND_AFLOAT) ((float*)a->data)[i] = (float)v;
+  else ((double*)a->data)[i] = v;
+}
+
+static size_t lbA_checkindex(lua_State *L, lbind_Array *a, int narg) {
+  lua_Integer i = luaL_checkinteger(L, narg);
+  luaL_argcheck(L, i >= 1 && (size_t)i <= a->size, narg,
+      "index out of range");
+  return (size_t)i - 1;
+}
+
+static int lbL_arrindex(lua_State *L) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  if (lua_type(L, 2) == LUA_TNUMBER) {
+    lua_Integer i = lua_tointeger(L, 2);
+    if (i >= 1 && (size_t)i <= a->size)
+      lua_pushnumber(L, (lua_Number)lbA_get(a, (size_t)i - 1));
+    else
+      lua_pushnil(L);
+    return 1;
+  }
+  lua_getmetatable(L, 1);
+  lua_pushvalue(L, 2);
+  lua_rawget(L, -2);
+  return 1;
+}
+
+static int lbL_arrnewindex(lua_State *L) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  lbA_set(a, lbA_checkindex(L, a, 2), (double)luaL_checknumber(L, 3));
+  return 0;
+}
+
+static int lbL_arrlen(lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)lbind_checkarray(L, 1)->size);
+  return 1;
+}
+
+static int lbL_arrtotable(lua_State *L) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  size_t i;
+  lua_createtable(L, (int)a->size, 0);
+  for (i = 0; i < a->size; ++i) {
+    lua_pushnumber(L, (lua_Number)lbA_get(a, i));
+    lua_rawseti(L, -2, (lua_Integer)i + 1);
+  }
+  return 1;
+}
+
+static int lbL_arrsum(lua_State *L) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  lua_pushnumber(L, (lua_Number)lbA_kernels(a->type)->sum(a->data, a->size));
+  return 1;
+}
+
+static int lbL_arrdot(lua_State *L) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  lbind_Array *b = lbind_checkarray(L, 2);
+  size_t i, n = a->size < b->size ? a->size : b->size;
+  double r = 0;
+  if (a->type == b->type)
+    r = lbA_kernels(a->type)->dot(a->data, b->data, n);
+  else for (i = 0; i < n; ++i)
+    r += lbA_get(a, i) * lbA_get(b, i);
+  lua_pushnumber(L, (lua_Number)r);
+  return 1;
+}
+
+static int lbA_minmax(lua_State *L, int max) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  double mn, mx;
+  if (a->size == 0) return 0;
+  lbA_kernels(a->type)->minmax(a->data, a->size, &mn, &mx);
+  lua_pushnumber(L, (lua_Number)(max ? mx : mn));
+  return 1;
+}
+
+static int lbL_arrmin(lua_State *L) { return lbA_minmax(L, 0); }
+static int lbL_arrmax(lua_State *L) { return lbA_minmax(L, 1); }
+
+static int lbA_arith(lua_State *L, int op) {
+  lbind_Array *a = lbind_checkarray(L, 1), *b;
+  if (lua_type(L, 2) == LUA_TNUMBER)
+    lbA_kernels(a->type)->arithk(a->data, a->size,
+        (double)lua_tonumber(L, 2), op);
+  else {
+    size_t i, n;
+    b = lbind_checkarray(L, 2);
+    n = a->size < b->size ? a->size : b->size;
+    if (a->type == b->type)
+      lbA_kernels(a->type)->arith(a->data, b->data, n, op);
+    else for (i = 0; i < n; ++i) {
+      double x = lbA_get(a, i), y = lbA_get(b, i);
+      switch (op) {
+      case LBA_ADD: x += y; break;
+      case LBA_SUB: x -= y; break;
+      case LBA_MUL: x *= y; break;
+      case LBA_DIV: x /= y; break;
+      }
+      lbA_set(a, i, x);
+    }
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+static int lbL_arradd(lua_State *L) { return lbA_arith(L, LBA_ADD); }
+static int lbL_arrsub(lua_State *L) { return lbA_arith(L, LBA_SUB); }
+static int lbL_arrmul(lua_State *L) { return lbA_arith(L, LBA_MUL); }
+static int lbL_arrdiv(lua_State *L) { return lbA_arith(L, LBA_DIV); }
+
+static int lbL_arrclamp(lua_State *L) {
+  lbind_Array *a = lbind_checkarray(L, 1);
+  double lo = (double)luaL_checknumber(L, 2);
+  double hi = (double)luaL_checknumber(L, 3);
+  luaL_argcheck(L, lo <= hi, 3, "empty range");
+  lbA_kernels(a->type)->clamp(a->data, a->size, lo, hi);
+  lua_settop(L, 1);
+  return 1;
+}
+
+static int lbL_arrgather(lua_State *L) {
+  /* a:gather(src, idx): a[i] = src[idx[i]] */
+  lbind_Array *a = lbind_checkarray(L, 1);
+  lbind_Array *src = lbind_checkarray(L, 2);
+  lbind_Array *idx = lbind_checkarray(L, 3);
+  size_t i, n = a->size < idx->size ? a->size : idx->size;
+  for (i = 0; i < n; ++i) {
+    double k = lbA_get(idx, i);
+    if (!(k >= 1 && k <= (double)src->size))
+      return luaL_error(L, "gather index %f out of range", k);
+    lbA_set(a, i, lbA_get(src, (size_t)k - 1));
+  }
+  lua_settop(L, 1);
+  return 1;
+}
+
+static int lbL_arrscatter(lua_State *L) {
+  /* a:scatter(dst, idx): dst[idx[i]] = a[i] */
+  lbind_Array *a = lbind_checkarray(L, 1);
+  lbind_Array *dst = lbind_checkarray(L, 2);
+  lbind_Array *idx = lbind_checkarray(L, 3);
+  size_t i, n = a->size < idx->size ? a->size : idx->size;
+  for (i = 0; i < n; ++i) {
+    double k = lbA_get(idx, i);
+    if (!(k >= 1 && k <= (double)dst->size))
+      return luaL_error(L, "scatter index %f out of range", k);
+    lbA_set(dst, (size_t)k - 1, lbA_get(a, i));
+  }
+  lua_settop(L, 2);
+  return 1;
+}
+
+LB_API lbind_Array *lbind_newarray(lua_State *L, size_t size, int type) {
+  luaL_Reg libs[] = {
+    { "__index",    lbL_arrindex    },
+    { "__len",      lbL_arrlen      },
+    { "__newindex", lbL_arrnewindex },
+    { "add",        lbL_arradd      },
+    { "clamp",      lbL_arrclamp    },
+    { "div",        lbL_arrdiv      },
+    { "dot",        lbL_arrdot      },
+    { "gather",     lbL_arrgather   },
+    { "max",        lbL_arrmax      },
+    { "min",        lbL_arrmin      },
+    { "mul",        lbL_arrmul      },
+    { "scatter",    lbL_arrscatter  },
+    { "sub",        lbL_arrsub      },
+    { "sum",        lbL_arrsum      },
+    { "totable",    lbL_arrtotable  },
+    { NULL, NULL }
+  };
+  size_t elemsize = type == LBIND_AFLOAT ? sizeof(float) : sizeof(double);
+  lbind_Array *a;
+  if (size > (~(size_t)0 - sizeof(lbind_Array)) / elemsize)
+    return NULL;
+  a = (lbind_Array*)lbind_raw(L, sizeof(lbind_Array) + size*elemsize, 0);
+  a->size = size;
+  a->type = type == LBIND_AFLOAT ? LBIND_AFLOAT : LBIND_ADOUBLE;
+  a->data = (void*)(a+1);
+  memset(a->data, 0, size*elemsize);
+  if (!lbind_getmetatable(L, &lbA_arraytype)
+      && !lbind_newmetatable(L, libs, &lbA_arraytype))
+    luaL_getmetatable(L, lbA_arraytype.name);
+  lua_setmetatable(L, -2);
+  return a;
+}
+
+LB_API lbind_Array *lbind_testarray(lua_State *L, int idx) {
+  return (lbind_Array*)lbind_test(L, idx, &lbA_arraytype);
+}
+
+LB_API lbind_Array *lbind_checkarray(lua_State *L, int idx) {
+  return (lbind_Array*)lbind_check(L, idx, &lbA_arraytype);
+}
+
+#endif /* LBIND_NO_ARRAY */
+
 
 /* lbind enum/mask support */
 #ifndef LBIND_NO_ENUM
@@ -1513,17 +4014,457 @@ LB_API int lbind_checkenum(lua_State *L, int idx, lbind_Enum *et) {
 #endif /* LBIND_NO_ENUM */
 
 
+/* lbind pool allocator */
+#ifndef LBIND_NO_POOL
+static void *lbH_defalloc(void *ud, void *p, size_t osize, size_t nsize) {
+  (void)ud; (void)osize;
+  if (nsize != 0)
+    return realloc(p, nsize);
+  free(p);
+  return NULL;
+}
+
+#define lbH_class(size) (((size)-1)/LBIND_POOLALIGN)
+
+static size_t lbH_findslab(lbind_Pool *pool, const char *p) {
+  /* index of the last slab starts at or before p */
+  size_t lo = 0, hi = pool->nslabs;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo)/2;
+    if (pool->slabs[mid] <= p) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+static char *lbH_slab(lbind_Pool *pool, void *p) {
+  /* slab holding p, or NULL if p is not from the pool */
+  size_t i = lbH_findslab(pool, (const char*)p);
+  if (i == 0 || (const char*)p >= pool->slabs[i-1] + LBIND_POOLSLAB)
+    return NULL;
+  return pool->slabs[i-1];
+}
+
+/* a slab serves one class, kept in its first aligned word */
+#define lbH_slabclass(slab) (*(int*)(slab))
+
+static int lbH_newslab(lbind_Pool *pool, int c) {
+  size_t i;
+  char *slab;
+  if (pool->nslabs == pool->maxslabs) {
+    size_t n = pool->maxslabs ? pool->maxslabs*2 : 16;
+    char **slabs = (char**)pool->f(pool->ud, pool->slabs,
+        pool->maxslabs*sizeof(char*), n*sizeof(char*));
+    if (slabs == NULL) return 0;
+    pool->slabs = slabs;
+    pool->maxslabs = n;
+  }
+  if ((slab = (char*)pool->f(pool->ud, NULL, 0, LBIND_POOLSLAB)) == NULL)
+    return 0;
+  i = lbH_findslab(pool, slab);
+  memmove(&pool->slabs[i+1], &pool->slabs[i],
+      (pool->nslabs - i)*sizeof(char*));
+  pool->slabs[i] = slab;
+  ++pool->nslabs;
+  pool->reserved += LBIND_POOLSLAB;
+  lbH_slabclass(slab) = c;
+  pool->cur[c] = slab + LBIND_POOLALIGN;
+  pool->end[c] = pool->cur[c] + (LBIND_POOLSLAB - LBIND_POOLALIGN)
+    / ((c+1)*LBIND_POOLALIGN) * ((c+1)*LBIND_POOLALIGN);
+  return 1;
+}
+
+static void *lbH_get(lbind_Pool *pool, size_t nsize) {
+  int c = (int)lbH_class(nsize);
+  void *p;
+  if ((p = pool->free[c]) != NULL)
+    pool->free[c] = *(void**)p;
+  else {
+    if (pool->cur[c] == pool->end[c] && !lbH_newslab(pool, c))
+      return NULL;
+    p = pool->cur[c];
+    pool->cur[c] += (c+1)*LBIND_POOLALIGN;
+  }
+  ++pool->hits;
+  pool->inuse += (c+1)*LBIND_POOLALIGN;
+  return p;
+}
+
+static void lbH_put(lbind_Pool *pool, void *p, int c) {
+  *(void**)p = pool->free[c];
+  pool->free[c] = p;
+  pool->inuse -= (c+1)*LBIND_POOLALIGN;
+}
+
+LB_API void lbind_initpool(lbind_Pool *pool, lua_Alloc f, void *ud) {
+  memset(pool, 0, sizeof(lbind_Pool));
+  pool->f = f != NULL ? f : lbH_defalloc;
+  pool->ud = ud;
+}
+
+LB_API void lbind_freepool(lbind_Pool *pool) {
+  size_t i;
+  for (i = 0; i < pool->nslabs; ++i)
+    pool->f(pool->ud, pool->slabs[i], LBIND_POOLSLAB, 0);
+  pool->f(pool->ud, pool->slabs, pool->maxslabs*sizeof(char*), 0);
+  lbind_initpool(pool, pool->f, pool->ud);
+}
+
+LB_API void *lbind_poolalloc(void *ud, void *p, size_t osize, size_t nsize) {
+  lbind_Pool *pool = (lbind_Pool*)ud;
+  char *slab = p != NULL ? lbH_slab(pool, p) : NULL;
+  void *np;
+  int c;
+  /* osize is a type tag when p is NULL */
+  if (slab == NULL) {
+    if (nsize != 0 && nsize <= LBIND_POOLMAX && p == NULL
+        && (np = lbH_get(pool, nsize)) != NULL)
+      return np;
+    if (nsize != 0 && p == NULL) ++pool->misses;
+    return pool->f(pool->ud, p, osize, nsize);
+  }
+  /* the class of p comes from its slab, not osize: a failed shrink
+   * keeps the larger block, which Lua then frees with the smaller size */
+  c = lbH_slabclass(slab);
+  if (nsize == 0) {
+    lbH_put(pool, p, c);
+    return NULL;
+  }
+  if (nsize <= LBIND_POOLMAX && (int)lbH_class(nsize) == c)
+    return p;
+  if ((nsize > LBIND_POOLMAX || (np = lbH_get(pool, nsize)) == NULL)
+      && (np = pool->f(pool->ud, NULL, 0, nsize)) != NULL)
+    ++pool->misses;
+  if (np == NULL) /* shrinking can't fail, the block is large enough */
+    return nsize <= (size_t)(c+1)*LBIND_POOLALIGN ? p : NULL;
+  memcpy(np, p, osize < nsize ? osize : nsize);
+  lbH_put(pool, p, c);
+  return np;
+}
+
+LB_API lua_State *lbind_newstate(lbind_Pool *pool) {
+  lbind_initpool(pool, NULL, NULL);
+  return lua_newstate(lbind_poolalloc, pool);
+}
+
+LB_API void lbind_setpool(lua_State *L, lbind_Pool *pool) {
+  void *ud;
+  lua_Alloc f = lua_getallocf(L, &ud);
+  lbind_initpool(pool, f, ud);
+  lua_setallocf(L, lbind_poolalloc, pool);
+}
+#endif /* LBIND_NO_POOL */
+
+
+/* lbind binary serialization */
+#ifndef LBIND_NO_PACK
+#define LBIND_WRITER "lbind.writer"
+
+struct lbind_Writer {
+  lua_State *L;
+  char *p;
+  size_t n, cap;
+  int depth; /* tables being packed */
+};
+
+typedef struct lbK_Reader {
+  const char *p, *end;
+  int depth;
+} lbK_Reader;
+
+#define lbK_ispod(t) ((t)->size != 0 && ((t)->flags & LBIND_POD) != 0)
+
+static int lbK_freewriter(lua_State *L) {
+  lbind_Writer *w = (lbind_Writer*)lua_touserdata(L, 1);
+  free(w->p);
+  w->p = NULL;
+  return 0;
+}
+
+LB_API void lbind_write(lbind_Writer *w, const void *s, size_t len) {
+  if (w->cap - w->n < len) {
+    size_t cap = w->cap != 0 ? w->cap : 256;
+    char *p;
+    while (cap - w->n < len) cap *= 2;
+    if ((p = (char*)realloc(w->p, cap)) == NULL)
+      luaL_error(w->L, "not enough memory to pack");
+    w->p = p;
+    w->cap = cap;
+  }
+  memcpy(w->p + w->n, s, len);
+  w->n += len;
+}
+
+static void lbK_tag(lbind_Writer *w, char tag) {
+  lbind_write(w, &tag, 1);
+}
+
+static void lbK_string(lbind_Writer *w, const char *s, size_t len) {
+  lbind_write(w, &len, sizeof(size_t));
+  lbind_write(w, s, len);
+}
+
+static void lbK_object(lua_State *L, lbind_Writer *w, int idx) {
+  lbind_Type *t = lbind_typeobject(L, idx);
+  void *p = lbind_object(L, idx);
+  size_t pos, len;
+  if (t == NULL || p == NULL
+      || (t->serialize == NULL && !lbK_ispod(t)))
+    luaL_error(L, "can't pack object of type '%s'",
+        t != NULL ? t->name : luaL_typename(L, idx));
+  lbK_tag(w, 'o');
+  lbK_string(w, t->name, strlen(t->name));
+  pos = w->n; /* fill the payload size after written */
+  len = 0;
+  lbind_write(w, &len, sizeof(size_t));
+  if (t->serialize != NULL)
+    t->serialize(L, p, w);
+  else
+    lbind_write(w, p, t->size);
+  len = w->n - pos - sizeof(size_t);
+  memcpy(w->p + pos, &len, sizeof(size_t));
+}
+
+static void lbK_pack(lua_State *L, lbind_Writer *w, int idx, int seen, lua_Integer *nseen) {
+  luaL_checkstack(L, 4, "value too deep to pack");
+  switch (lua_type(L, idx)) {
+  case LUA_TNIL: lbK_tag(w, 'n'); return;
+  case LUA_TBOOLEAN: lbK_tag(w, lua_toboolean(L, idx) ? 't' : 'f'); return;
+  case LUA_TNUMBER: {
+#if LUA_VERSION_NUM >= 503
+    if (lua_isinteger(L, idx)) {
+      lua_Integer i = lua_tointeger(L, idx);
+      lbK_tag(w, 'i');
+      lbind_write(w, &i, sizeof(i));
+      return;
+    }
+#endif
+    lua_Number n = lua_tonumber(L, idx);
+    lbK_tag(w, 'd');
+    lbind_write(w, &n, sizeof(n));
+    return;
+  }
+  case LUA_TSTRING: {
+    size_t len;
+    const char *s = lua_tolstring(L, idx, &len);
+    lbK_tag(w, 's');
+    lbK_string(w, s, len);
+    return;
+  }
+  case LUA_TTABLE: case LUA_TUSERDATA:
+    lua_pushvalue(L, idx);
+    lua_rawget(L, seen);
+    if (!lua_isnil(L, -1)) {
+      lua_Integer i = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+      lbK_tag(w, 'r');
+      lbind_write(w, &i, sizeof(i));
+      return;
+    }
+    lua_pop(L, 1);
+    lua_pushvalue(L, idx);
+    lua_pushinteger(L, ++*nseen);
+    lua_rawset(L, seen);
+    if (lua_type(L, idx) == LUA_TUSERDATA) {
+      lbK_object(L, w, idx);
+      return;
+    }
+    if (++w->depth > LBIND_MAXPACKDEPTH)
+      luaL_error(L, "value too deep to pack");
+    lbK_tag(w, 'T');
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+      int top = lua_gettop(L);
+      lbK_pack(L, w, top-1, seen, nseen);
+      lbK_pack(L, w, top, seen, nseen);
+      lua_pop(L, 1);
+    }
+    lbK_tag(w, 'e');
+    --w->depth;
+    return;
+  }
+  luaL_error(L, "can't pack value of type '%s'", luaL_typename(L, idx));
+}
+
+LB_API void lbind_pack(lua_State *L, int idx) {
+  lbind_Writer *w;
+  lua_Integer nseen = 0;
+  if (idx < 0 && idx > LUA_REGISTRYINDEX) idx += lua_gettop(L) + 1;
+  w = (lbind_Writer*)lua_newuserdata(L, sizeof(lbind_Writer)); /* 1 */
+  w->L = L;
+  w->p = NULL;
+  w->n = w->cap = 0;
+  w->depth = 0;
+  if (luaL_newmetatable(L, LBIND_WRITER)) {
+    lua_pushcfunction(L, lbK_freewriter);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  lua_newtable(L); /* 2 */
+  lbK_pack(L, w, idx, lua_gettop(L), &nseen);
+  lua_pop(L, 1); /* (2) */
+  lua_pushlstring(L, w->p != NULL ? w->p : "", w->n); /* 2 */
+  free(w->p);
+  w->p = NULL;
+  lua_remove(L, -2); /* (1) */
+}
+
+static void lbK_read(lua_State *L, lbK_Reader *r, void *p, size_t len) {
+  if ((size_t)(r->end - r->p) < len)
+    luaL_error(L, "truncated pack data");
+  memcpy(p, r->p, len);
+  r->p += len;
+}
+
+static const char *lbK_readstring(lua_State *L, lbK_Reader *r, size_t *plen) {
+  const char *s;
+  lbK_read(L, r, plen, sizeof(size_t));
+  if ((size_t)(r->end - r->p) < *plen)
+    luaL_error(L, "truncated pack data");
+  s = r->p;
+  r->p += *plen;
+  return s;
+}
+
+static void lbK_nocopy(void *dst, void *src) {
+  (void)dst; (void)src;
+}
+
+static void lbK_unobject(lua_State *L, lbK_Reader *r) {
+  size_t len;
+  const char *s = lbK_readstring(L, r, &len);
+  lbind_Type *t;
+  lua_pushlstring(L, s, len);
+  lua_rawget(L, LUA_REGISTRYINDEX);
+  t = lua_istable(L, -1) ? lbind_typeobject(L, -1) : NULL;
+  lua_pop(L, 1);
+  if (t == NULL)
+    luaL_error(L, "unknown type '%s' in pack data", lua_pushlstring(L, s, len));
+  s = lbK_readstring(L, r, &len);
+  if (t->deserialize != NULL) {
+    if (t->deserialize(L, s, len) == NULL)
+      luaL_error(L, "invalid pack data of type '%s'", t->name);
+  }
+  else if (lbK_ispod(t) && len == t->size) {
+    lbT_construct(L, NULL, t, lbK_nocopy);
+    memcpy(lbind_object(L, -1), s, len);
+  }
+  else
+    luaL_error(L, "can't unpack object of type '%s'", t->name);
+}
+
+static void lbK_unpack(lua_State *L, lbK_Reader *r, int refs, lua_Integer *nrefs) {
+  char tag;
+  luaL_checkstack(L, 4, "pack data too deep");
+  lbK_read(L, r, &tag, 1);
+  switch (tag) {
+  case 'n': lua_pushnil(L); return;
+  case 't': case 'f': lua_pushboolean(L, tag == 't'); return;
+  case 'i': {
+    lua_Integer i;
+    lbK_read(L, r, &i, sizeof(i));
+    lua_pushinteger(L, i);
+    return;
+  }
+  case 'd': {
+    lua_Number n;
+    lbK_read(L, r, &n, sizeof(n));
+    lua_pushnumber(L, n);
+    return;
+  }
+  case 's': {
+    size_t len;
+    const char *s = lbK_readstring(L, r, &len);
+    lua_pushlstring(L, s, len);
+    return;
+  }
+  case 'r': {
+    lua_Integer i;
+    lbK_read(L, r, &i, sizeof(i));
+    if (i < 1 || i > *nrefs)
+      luaL_error(L, "invalid reference in pack data");
+    lua_rawgeti(L, refs, (int)i);
+    return;
+  }
+  case 'o':
+    lbK_unobject(L, r);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, refs, (int)++*nrefs);
+    return;
+  case 'T':
+    if (++r->depth > LBIND_MAXPACKDEPTH)
+      luaL_error(L, "pack data too deep");
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, refs, (int)++*nrefs);
+    while (r->p < r->end && *r->p != 'e') {
+      lbK_unpack(L, r, refs, nrefs);
+      if (lua_isnil(L, -1))
+        luaL_error(L, "invalid table key in pack data");
+      lbK_unpack(L, r, refs, nrefs);
+      lua_rawset(L, -3);
+    }
+    lbK_read(L, r, &tag, 1);
+    --r->depth;
+    return;
+  }
+  luaL_error(L, "invalid tag '%c' in pack data", tag);
+}
+
+LB_API int lbind_unpack(lua_State *L, const char *s, size_t len) {
+  lbK_Reader r;
+  lua_Integer nrefs = 0;
+  r.p = s;
+  r.end = s + len;
+  r.depth = 0;
+  lua_newtable(L); /* 1 */
+  lbK_unpack(L, &r, lua_gettop(L), &nrefs); /* 2 */
+  if (r.p != r.end)
+    luaL_error(L, "extra bytes after pack data");
+  lua_remove(L, -2); /* (1) */
+  return 1;
+}
+#endif /* LBIND_NO_PACK */
+
+
 /* lbind Lua side runtime */
 #ifndef LBIND_NO_RUNTIME
 static lbind_Type *lbT_test(lua_State *L, int idx) {
   lbind_Type *t = (lbind_Type*)lua_touserdata(L, idx);
   lbB_typebox(L);
   lua_rawgetp(L, -1, t);
-  t = lua_touserdata(L, -1);
+  t = (lbind_Type*)lua_touserdata(L, -1);
   lua_pop(L, 2);
   return t != NULL ? t : lbind_typeobject(L, -1);
 }
 
+#ifndef LBIND_NO_ARRAY
+static int lbL_array(lua_State *L) {
+  /* lbind.array(size|table [, "float"|"double"]) */
+  static const char *const opts[] = { "float", "double", NULL };
+  int type = luaL_checkoption(L, 2, "double", opts);
+  lbind_Array *a;
+  if (lua_istable(L, 1)) {
+    size_t i, size = lua_rawlen(L, 1);
+    if ((a = lbind_newarray(L, size, type)) == NULL)
+      return luaL_argerror(L, 1, "array too large");
+    for (i = 0; i < size; ++i) {
+      lua_rawgeti(L, 1, (lua_Integer)i + 1);
+      lbA_set(a, i, (double)lua_tonumber(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  else {
+    lua_Integer size = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, size >= 0, 1, "invalid size");
+    if ((lua_Integer)(size_t)size != size
+        || lbind_newarray(L, (size_t)size, type) == NULL)
+      return luaL_argerror(L, 1, "array too large");
+  }
+  return 1;
+}
+#endif /* LBIND_NO_ARRAY */
+
 static int lbL_bases(lua_State *L) {
   int i = 1;
   lbind_Type **bases, *t = lbT_test(L, 1);
@@ -1545,6 +4486,41 @@ static int lbL_bases(lua_State *L) {
   return 1;
 }
 
+static int lbL_scopeclose(lua_State *L) {
+  /* upvalue: objects to close */
+  int i, top = lua_gettop(L), n = (int)lua_rawlen(L, lua_upvalueindex(1));
+  for (i = 1; i <= top; ++i) {
+    lua_pushvalue(L, i);
+    lua_rawseti(L, lua_upvalueindex(1), n + i);
+  }
+  return top;
+}
+
+static int lbL_scope(lua_State *L) {
+  int i, status;
+  luaL_checktype(L, 1, LUA_TFUNCTION);
+  lua_newtable(L);
+  lua_insert(L, 1); /* stack: list f ... */
+  lua_pushvalue(L, 1);
+  lua_pushcclosure(L, lbL_scopeclose, 1);
+  lua_insert(L, 3); /* stack: list f close ... */
+  status = lua_pcall(L, lua_gettop(L) - 2, LUA_MULTRET, 0);
+  for (i = (int)lua_rawlen(L, 1); i > 0; --i) {
+    lua_rawgeti(L, 1, i);
+    if (lbind_typeobject(L, -1) != NULL)
+      lbind_close(L, -1);
+    else if (luaL_getmetafield(L, -1, "__close")) {
+      lua_insert(L, -2);
+      lua_call(L, 1, 0);
+      continue;
+    }
+    lua_pop(L, 1);
+  }
+  if (status != LUA_OK)
+    return lua_error(L);
+  return lua_gettop(L) - 1;
+}
+
 static int lbL_track(lua_State *L) {
   int i, top = lua_gettop(L);
   for (i = 1; i <= top; ++i)
@@ -1605,7 +4581,8 @@ static int lbL_pointer(lua_State *L) {
 static int lbL_delete(lua_State *L) {
   int i, top = lua_gettop(L);
   for (i = 1; i <= top; ++i) {
-    if (lua53_getfield(L, i, "delete") != LUA_TNIL) {
+    lua_pushvalue(L, lua_upvalueindex(1)); /* "delete" */
+    if (lua53_gettable(L, i) != LUA_TNIL) {
       lua_pushvalue(L, i);
       lua_call(L, 1, 0);
     }
@@ -1631,6 +4608,22 @@ static int lbL_isa(lua_State *L) {
   return top - 1;
 }
 
+#ifndef LBIND_NO_BUFFER
+static int lbL_buffer(lua_State *L) {
+  size_t len = 0;
+  const char *s = luaL_optlstring(L, 2, NULL, &len);
+  lua_Integer capacity = luaL_optinteger(L, 1, (lua_Integer)len);
+  lbind_Buffer *b;
+  luaL_argcheck(L, capacity >= 0, 1, "invalid capacity");
+  b = lbind_newbuffer(L, (size_t)capacity);
+  if (s != NULL) {
+    b->size = len < b->capacity ? len : b->capacity;
+    memcpy(b->data, s, b->size);
+  }
+  return 1;
+}
+#endif /* LBIND_NO_BUFFER */
+
 static int lbL_castto(lua_State *L) {
   lbind_Type *t = lbT_test(L, 1);
   int i, top = lua_gettop(L);
@@ -1647,24 +4640,96 @@ static int lbL_castto(lua_State *L) {
   return top - 1;
 }
 
+#ifndef LBIND_NO_TRANSFER
+static lbind_Mailbox *lbX_checkmailbox(lua_State *L, int idx) {
+  lbind_Mailbox *mb = (lbind_Mailbox*)lua_touserdata(L, idx);
+  if (!lua_islightuserdata(L, idx) || mb == NULL)
+    lbind_typeerror(L, idx, "mailbox");
+  return mb;
+}
+
+static int lbL_transfer(lua_State *L) {
+  lbind_Mailbox *mb = lbX_checkmailbox(L, 1);
+  int i, top = lua_gettop(L), count = 0;
+  for (i = 2; i <= top; ++i)
+    count += lbind_transfer(L, i, mb);
+  lua_pushinteger(L, count);
+  return 1;
+}
+
+static int lbL_receive(lua_State *L) {
+  lbind_Mailbox *mb = lbX_checkmailbox(L, 1);
+  int count = 0;
+  while (lua_checkstack(L, 1) && lbind_receive(L, mb))
+    ++count;
+  return count;
+}
+#endif /* LBIND_NO_TRANSFER */
+
+#ifndef LBIND_NO_PACK
+static int lbL_pack(lua_State *L) {
+  luaL_checkany(L, 1);
+  lbind_pack(L, 1);
+  return 1;
+}
+
+static int lbL_unpack(lua_State *L) {
+  size_t len;
+  const char *s = luaL_checklstring(L, 1, &len);
+  return lbind_unpack(L, s, len);
+}
+#endif /* LBIND_NO_PACK */
+
+#ifndef LBIND_NO_ASYNC
+static int lbL_poll(lua_State *L) {
+  lua_pushinteger(L, lbind_poll(L));
+  return 1;
+}
+#endif /* LBIND_NO_ASYNC */
+
 LBLIB_API int luaopen_lbind(lua_State *L) {
   luaL_Reg libs[] = {
 #define ENTRY(name) { #name, lbL_##name }
+#ifndef LBIND_NO_ARRAY
+    ENTRY(array),
+#endif
     ENTRY(bases),
+#ifndef LBIND_NO_BUFFER
+    ENTRY(buffer),
+#endif
     ENTRY(castto),
-    ENTRY(delete),
     ENTRY(isa),
     ENTRY(owner),
+#ifndef LBIND_NO_PACK
+    ENTRY(pack),
+#endif
     ENTRY(pointer),
+#ifndef LBIND_NO_ASYNC
+    ENTRY(poll),
+#endif
+#ifndef LBIND_NO_TRANSFER
+    ENTRY(receive),
+#endif
+    ENTRY(scope),
     ENTRY(track),
+#ifndef LBIND_NO_TRANSFER
+    ENTRY(transfer),
+#endif
     ENTRY(type),
+#ifndef LBIND_NO_PACK
+    ENTRY(unpack),
+#endif
     ENTRY(untrack),
 #undef ENTRY
     { NULL, NULL }
   };
 
   luaL_newlib(L, libs);
+  lua_pushliteral(L, "delete");
+  lua_pushcclosure(L, lbL_delete, 1);
+  lua_setfield(L, -2, "delete");
 #if LUA_VERSION_NUM < 502
+  lbind_mainthread(L);
   lua_pushvalue(L, -1);
   lua_setglobal(L, "lbind");
 #endif
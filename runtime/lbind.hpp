@@ -0,0 +1,331 @@
+#ifndef LBIND_HPP
+#define LBIND_HPP
+
+
+#include "lbind.h"
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+
+/* lbind C++ binding layer
+ *
+ * every bound class has a static lbind_Type, got by
+ * `lbind::type_of<T>()`, its name is declared once with:
+ *
+ *   LBIND_TYPENAME(test, "test")
+ *
+ * at global scope. conversions are done by `lbind::stack<T>`, which
+ * can be specialized for user types. functions and methods are bound
+ * without any runtime dispatch:
+ *
+ *   luaL_Reg libs[] = {
+ *     { "x", lbind::wrap<&test::x> },     (C++17)
+ *     { "x", LBIND_WRAP(&test::x) },      (C++11)
+ *     ...
+ *   };
+ *
+ * the first argument of a method is the object itself, others are
+ * checked from stack index 2.
+ */
+
+#define LBIND_TYPENAME(T, tname)                               \
+  namespace lbind {                                            \
+  template <> struct type_name<T> {                            \
+    static constexpr const char *name() { return tname; }      \
+  };                                                           \
+  }
+
+#define LBIND_WRAP(f) (&::lbind::wrapper<decltype(f), (f)>::call)
+
+
+namespace lbind {
+
+
+template <class T> struct type_name {
+  static_assert(sizeof(T) == 0,
+      "type is not declared, use LBIND_TYPENAME(T, name)");
+};
+
+/* copyable classes are value types, see `lbind_setvalue` */
+template <class T> struct value_ops {
+  static void copy(void *dst, void *src)
+  { new (dst) T(*static_cast<const T*>(src)); }
+  static void move(void *dst, void *src)
+  { new (dst) T(std::move(*static_cast<T*>(src))); }
+  static void destroy(void *p)
+  { static_cast<T*>(p)->~T(); }
+};
+
+template <class T> inline void init_value(lbind_Type *t, std::true_type) {
+  lbind_setvalue(t, sizeof(T), value_ops<T>::copy, value_ops<T>::move,
+      std::is_trivially_destructible<T>::value ? NULL : value_ops<T>::destroy);
+  lbind_setpod(t, std::is_trivially_copyable<T>::value);
+}
+
+template <class T> inline void init_value(lbind_Type *, std::false_type) {}
+
+template <class T> inline lbind_Type *make_type() {
+  static lbind_Type t = LBIND_INIT(type_name<T>::name());
+  init_value<T>(&t, std::integral_constant<bool,
+      std::is_class<T>::value && !std::is_abstract<T>::value &&
+      std::is_copy_constructible<T>::value &&
+      alignof(T) <= alignof(lbind_MaxAlign)>());
+  return &t;
+}
+
+template <class T> inline lbind_Type *type_of() {
+  static lbind_Type *t = make_type<typename std::remove_cv<T>::type>();
+  return t;
+}
+
+
+/* stack conversion traits */
+
+template <class T, class Enable = void> struct stack {
+  /* class types, passed by value */
+  static T &check(lua_State *L, int idx)
+  { return *static_cast<T*>(lbind_check(L, idx, type_of<T>())); }
+  static void push(lua_State *L, const T &v)
+  { if (!lbind_copy(L, &v, type_of<T>())) lua_pushnil(L); }
+  static void push(lua_State *L, T &&v)
+  { if (!lbind_move(L, &v, type_of<T>())) lua_pushnil(L); }
+};
+
+template <class T> struct stack<T, typename std::enable_if<
+    std::is_integral<T>::value || std::is_enum<T>::value>::type> {
+  static T check(lua_State *L, int idx)
+  { return static_cast<T>(luaL_checkinteger(L, idx)); }
+  static void push(lua_State *L, T v)
+  { lua_pushinteger(L, static_cast<lua_Integer>(v)); }
+};
+
+template <class T> struct stack<T, typename std::enable_if<
+    std::is_floating_point<T>::value>::type> {
+  static T check(lua_State *L, int idx)
+  { return static_cast<T>(luaL_checknumber(L, idx)); }
+  static void push(lua_State *L, T v)
+  { lua_pushnumber(L, static_cast<lua_Number>(v)); }
+};
+
+template <> struct stack<bool> {
+  static bool check(lua_State *L, int idx)
+  { return lua_toboolean(L, idx) != 0; }
+  static void push(lua_State *L, bool v)
+  { lua_pushboolean(L, v); }
+};
+
+template <> struct stack<const char*> {
+  static const char *check(lua_State *L, int idx)
+  { return luaL_checkstring(L, idx); }
+  static void push(lua_State *L, const char *v)
+  { lua_pushstring(L, v); }
+};
+
+template <> struct stack<std::string> {
+  static std::string check(lua_State *L, int idx) {
+    size_t len;
+    const char *s = luaL_checklstring(L, idx, &len);
+    return std::string(s, len);
+  }
+  static void push(lua_State *L, const std::string &v)
+  { lua_pushlstring(L, v.data(), v.size()); }
+};
+
+#ifndef LBIND_NO_BUFFER
+template <> struct stack<lbind_Buffer*> {
+  static lbind_Buffer *check(lua_State *L, int idx)
+  { return lbind_checkbuffer(L, idx); }
+  static void push(lua_State *L, lbind_Buffer *v)
+  { lbind_pushbuffer(L, v); }
+};
+#endif
+
+template <class T> struct stack<T*, typename std::enable_if<
+    std::is_class<T>::value>::type> {
+  static T *check(lua_State *L, int idx)
+  { return static_cast<T*>(lbind_check(L, idx, type_of<T>())); }
+  static void push(lua_State *L, T *v) {
+    if (v == NULL)
+      lua_pushnil(L);
+    else if (!lbind_retrieve(L, v))
+      lbind_wrap(L, (void*)v, type_of<T>());
+  }
+};
+
+/* holders keep a shared_ptr<void>, as the object may be held as a
+ * derived type; check() aliases it with the cast pointer */
+template <class T> struct stack<std::shared_ptr<T> > {
+  typedef std::shared_ptr<void> holder_type;
+  static void release(void *holder)
+  { static_cast<holder_type*>(holder)->~holder_type(); }
+  static std::shared_ptr<T> check(lua_State *L, int idx) {
+    void *holder;
+    T *p = stack<T*>::check(L, idx);
+    if ((holder = lbind_holder(L, idx)) == NULL)
+      lbind_typeerror(L, idx, "shared object");
+    return std::shared_ptr<T>(*static_cast<holder_type*>(holder), p);
+  }
+  static void push(lua_State *L, std::shared_ptr<T> v) {
+    T *p = v.get();
+    if (p == NULL) { lua_pushnil(L); return; }
+    new (lbind_hold(L, (void*)p, sizeof(holder_type), release, type_of<T>()))
+      holder_type(std::move(v));
+  }
+};
+
+/* arguments and results are converted by their decayed type */
+template <class T> struct value : stack<typename std::decay<T>::type> {};
+
+
+/* function wrappers */
+
+template <std::size_t... I> struct indices {};
+template <std::size_t N, std::size_t... I>
+struct make_indices : make_indices<N-1, N-1, I...> {};
+template <std::size_t... I>
+struct make_indices<0, I...> { typedef indices<I...> type; };
+
+template <class R> struct result {
+  template <class C, class M, class... A>
+  static int member(lua_State *L, C *self, M f, A&&... args)
+  { value<R>::push(L, (self->*f)(std::forward<A>(args)...)); return 1; }
+  template <class F, class... A>
+  static int function(lua_State *L, F f, A&&... args)
+  { value<R>::push(L, f(std::forward<A>(args)...)); return 1; }
+};
+
+template <> struct result<void> {
+  template <class C, class M, class... A>
+  static int member(lua_State *, C *self, M f, A&&... args)
+  { (self->*f)(std::forward<A>(args)...); return 0; }
+  template <class F, class... A>
+  static int function(lua_State *, F f, A&&... args)
+  { f(std::forward<A>(args)...); return 0; }
+};
+
+template <class F, F f> struct wrapper;
+
+template <class R, class... A, R (*f)(A...)>
+struct wrapper<R (*)(A...), f> {
+  template <std::size_t... I>
+  static int invoke(lua_State *L, indices<I...>)
+  { return result<R>::function(L, f, value<A>::check(L, I+1)...); }
+  static int call(lua_State *L)
+  { return invoke(L, typename make_indices<sizeof...(A)>::type()); }
+};
+
+template <class R, class C, class... A, R (C::*f)(A...)>
+struct wrapper<R (C::*)(A...), f> {
+  template <std::size_t... I>
+  static int invoke(lua_State *L, indices<I...>) {
+    C *self = stack<C*>::check(L, 1);
+    return result<R>::member(L, self, f, value<A>::check(L, I+2)...);
+  }
+  static int call(lua_State *L)
+  { return invoke(L, typename make_indices<sizeof...(A)>::type()); }
+};
+
+template <class R, class C, class... A, R (C::*f)(A...) const>
+struct wrapper<R (C::*)(A...) const, f> {
+  template <std::size_t... I>
+  static int invoke(lua_State *L, indices<I...>) {
+    const C *self = stack<C*>::check(L, 1);
+    return result<R>::member(L, self, f, value<A>::check(L, I+2)...);
+  }
+  static int call(lua_State *L)
+  { return invoke(L, typename make_indices<sizeof...(A)>::type()); }
+};
+
+#if __cplusplus >= 201703L
+template <auto f> inline int wrap(lua_State *L)
+{ return wrapper<decltype(f), f>::call(L); }
+#endif
+
+
+/* director trampolines
+ *
+ * a director class derives the bound class and `lbind::director`, and
+ * its overriders check the Lua side first:
+ *
+ *   struct test_director : test, lbind::director {
+ *     test_director(lua_State *L, int x) : test(x), director(L) {}
+ *     int vx() {
+ *       int r;
+ *       return call(this, 0, &r) ? r : test::vx();
+ *     }
+ *   };
+ *
+ * where 0 is the index of "vx" in `virtuals` of its lbind_Type.
+ */
+
+struct director {
+  lbind_Director d;
+  explicit director(lua_State *L) { lbind_initdirector(L, &d); }
+  virtual ~director() { lbind_freedirector(&d); }
+
+  template <class T>
+  static lbind_Director *get(void *p)
+  { director *self = dynamic_cast<director*>(static_cast<T*>(p));
+    return self != NULL ? &self->d : NULL; }
+
+  template <class R, class... A>
+  bool call(const void *self, int i, R *ret, A&&... args) {
+    lua_State *L = d.L;
+    if (!lbind_override(&d, self, i)) return false;
+    luaL_checkstack(L, sizeof...(A), "too many arguments to override");
+    push_args(L, std::forward<A>(args)...);
+    lua_call(L, sizeof...(A)+1, 1);
+    *ret = value<R>::check(L, -1);
+    lua_pop(L, 1);
+    return true;
+  }
+
+  template <class... A>
+  bool call(const void *self, int i, void *, A&&... args) {
+    lua_State *L = d.L;
+    if (!lbind_override(&d, self, i)) return false;
+    luaL_checkstack(L, sizeof...(A), "too many arguments to override");
+    push_args(L, std::forward<A>(args)...);
+    lua_call(L, sizeof...(A)+1, 0);
+    return true;
+  }
+
+private:
+  static void push_args(lua_State *) {}
+  template <class T, class... A>
+  static void push_args(lua_State *L, T &&v, A&&... args) {
+    value<T>::push(L, std::forward<T>(v));
+    push_args(L, std::forward<A>(args)...);
+  }
+};
+
+
+/* constructor and destructor of tracked objects */
+
+template <class T, class... A> struct constructor {
+  template <std::size_t... I>
+  static int invoke(lua_State *L, indices<I...>) {
+    std::unique_ptr<T> p(new T(value<A>::check(L, I+1)...));
+    lbind_wrap(L, p.get(), type_of<T>());
+    p.release();
+    return 1;
+  }
+  static int call(lua_State *L)
+  { return invoke(L, typename make_indices<sizeof...(A)>::type()); }
+};
+
+template <class T> inline int destructor(lua_State *L) {
+  delete static_cast<T*>(lbind_delete(L, 1));
+  return 0;
+}
+
+
+} /* namespace lbind */
+
+#endif /* LBIND_HPP */
+/* vim: set sw=2: */
@@ -0,0 +1,86 @@
+#define LBIND_STATIC_API
+#include "../runtime/lbind.h"
+/* cc: lua='lua54' output='async.so' run='$lua async.lua'
+ * cc: flags+='-s -O2 -Wall -std=c99 -pedantic -shared -fPIC -I/usr/include/$lua'
+ */
+
+/* a executor keeps jobs until `run` is called, so the test decides
+ * when they complete */
+#define MAXJOBS 16
+
+static lbind_Job *jobs[MAXJOBS];
+static int njobs;
+
+static void queue_job(void *ud, lbind_Job *job) {
+  (void)ud;
+  jobs[njobs++] = job;
+}
+
+typedef struct {
+  lua_Integer a, b, r;
+} AddJob;
+
+static void add_work(void *data) {
+  AddJob *j = (AddJob*)data;
+  j->r = j->a + j->b;
+}
+
+static int add_finish(lua_State *L, void *data) {
+  AddJob *j = (AddJob*)data;
+  lua_pushinteger(L, j->r);
+  return 1;
+}
+
+static int fail_finish(lua_State *L, void *data) {
+  (void)data;
+  return luaL_error(L, "finish failed");
+}
+
+static int Ladd(lua_State *L) {
+  lua_Integer a = luaL_checkinteger(L, 1), b = luaL_checkinteger(L, 2);
+  AddJob *j = (AddJob*)lbind_newjob(L, sizeof(AddJob), add_work, add_finish);
+  j->a = a;
+  j->b = b;
+  return lbind_await(L, j);
+}
+
+static int Lfail(lua_State *L) {
+  AddJob *j = (AddJob*)lbind_newjob(L, sizeof(AddJob), add_work, fail_finish);
+  j->a = j->b = 0;
+  return lbind_await(L, j);
+}
+
+static int Lsetexecutor(lua_State *L) {
+  lbind_setexecutor(L, lua_toboolean(L, 1) ? queue_job : NULL, NULL);
+  return 0;
+}
+
+static int Lrun(lua_State *L) {
+  int i, n = njobs;
+  for (i = 0; i < n; ++i)
+    lbind_runjob(jobs[i]);
+  njobs = 0;
+  lua_pushinteger(L, n);
+  return 1;
+}
+
+static int Lpoll(lua_State *L) {
+  lua_pushinteger(L, lbind_poll(L));
+  return 1;
+}
+
+LUALIB_API int luaopen_async(lua_State *L) {
+  luaL_Reg libs[] = {
+    { "add", Ladd },
+    { "fail", Lfail },
+    { "setexecutor", Lsetexecutor },
+    { "run", Lrun },
+    { "poll", Lpoll },
+    { NULL, NULL }
+  };
+  luaL_newlib(L, libs);
+  /* jobs always run at once before 5.3 */
+  lua_pushboolean(L, LUA_VERSION_NUM >= 503);
+  lua_setfield(L, -2, "yieldable");
+  return 1;
+}
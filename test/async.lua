@@ -0,0 +1,51 @@
+local async = require 'async'
+
+-- no executor: the job runs at once
+assert(async.add(1, 2) == 3)
+assert(not pcall(async.fail))
+
+-- the main thread can't yield, the job runs at once too
+async.setexecutor(true)
+assert(async.add(3, 4) == 7)
+
+local yieldable = async.yieldable
+
+-- a coroutine awaits the job, lbind.poll() resumes it
+local result
+local co = coroutine.create(function(a, b)
+    result = async.add(a, b)
+    return "done"
+end)
+assert(coroutine.resume(co, 10, 20))
+if yieldable then
+    assert(result == nil and coroutine.status(co) == "suspended")
+    assert(async.poll() == 0)
+    assert(async.run() == 1)
+    assert(async.poll() == 1)
+end
+assert(result == 30 and coroutine.status(co) == "dead")
+
+-- errors of finish are raised in the coroutine
+local ok, err
+co = coroutine.create(function()
+    ok, err = pcall(async.fail)
+end)
+assert(coroutine.resume(co))
+if yieldable then
+    assert(async.run() == 1)
+    assert(async.poll() == 1)
+end
+assert(not ok and err:match "finish failed")
+
+-- only lbind.poll() may resume a awaiting coroutine
+if yieldable then
+    co = coroutine.create(function() return async.add(1, 1) end)
+    assert(coroutine.resume(co))
+    local ok, err = coroutine.resume(co)
+    assert(not ok and err:match "awaiting")
+    assert(async.run() == 1)
+    assert(async.poll() == 1)
+end
+
+async.setexecutor(false)
+print "async ok"